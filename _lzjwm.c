@@ -0,0 +1,204 @@
+/* python bindings for the C encoder and decoder. lzjwm.py uses them when they
+ * have been built with setup.py and gives the same output either way. */
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include "lzjwm.h"
+
+#define FORMAT_ERROR "unsupported format"
+#define INPUT_ERROR "can't compress, the input must be 7 bit"
+
+static bool params_ok(const struct lzjwm_params *params)
+{
+        if (lzjwm_params_ok(params))
+                return true;
+        PyErr_SetString(PyExc_ValueError, FORMAT_ERROR);
+        return false;
+}
+
+/* shrink the output to what was written or raise if nothing was */
+static PyObject *finish(PyObject *out, ssize_t n, const char *error)
+{
+        if (n < 0 || !out) {
+                Py_XDECREF(out);
+                if (!PyErr_Occurred())
+                        PyErr_SetString(PyExc_ValueError, error);
+                return NULL;
+        }
+        if (_PyBytes_Resize(&out, n) < 0)
+                return NULL;
+        return out;
+}
+
+PyDoc_STRVAR(compress_doc,
+"compress(data, count_bits=2, zero_bits=0, level=0, bound=0) -> bytes\n\n"
+"compress data, which must be 7 bit. a bound above 0 is as for lzjwm -B.");
+
+static PyObject *compress(PyObject *self, PyObject *args, PyObject *kw)
+{
+        static char *kwlist[] = { "data", "count_bits", "zero_bits", "level", "bound", NULL };
+        Py_buffer in;
+        struct lzjwm_params params = LZJWM_DEFAULT_PARAMS;
+        int level = LZJWM_LEVEL_FAST;
+        unsigned bound = 0;
+        if (!PyArg_ParseTupleAndKeywords(args, kw, "y*|iiiI", kwlist, &in, &params.count_bits,
+                                         &params.zero_bits, &level, &bound))
+                return NULL;
+        ssize_t n = -1;
+        PyObject *out = NULL;
+        if (params_ok(&params) && (out = PyBytes_FromStringAndSize(NULL, in.len))) {
+                char *optr = PyBytes_AS_STRING(out);
+                Py_BEGIN_ALLOW_THREADS
+                n = bound ? lzjwm_compress_bounded(in.buf, in.len, optr, level, &params, bound)
+                          : lzjwm_compress_params(in.buf, in.len, optr, level, &params);
+                Py_END_ALLOW_THREADS
+        }
+        PyBuffer_Release(&in);
+        return finish(out, n, INPUT_ERROR);
+}
+
+PyDoc_STRVAR(decompress_doc,
+"decompress(data, count_bits=2, zero_bits=0) -> bytes\n\n"
+"decompress all of data, raises ValueError if it refers back past its start.");
+
+static PyObject *decompress(PyObject *self, PyObject *args, PyObject *kw)
+{
+        static char *kwlist[] = { "data", "count_bits", "zero_bits", NULL };
+        Py_buffer in;
+        struct lzjwm_params params = LZJWM_DEFAULT_PARAMS;
+        if (!PyArg_ParseTupleAndKeywords(args, kw, "y*|ii", kwlist, &in, &params.count_bits, &params.zero_bits))
+                return NULL;
+        ssize_t n = -1;
+        PyObject *out = NULL;
+        /* the decoders trust the data so check it first */
+        struct lzjwm_work work;
+        if (params_ok(&params) && lzjwm_decode_work(in.buf, in.len, &params, &work) >= 0) {
+                size_t size = lzjwm_decompressed_size_params(in.buf, in.len, &params);
+                if ((out = PyBytes_FromStringAndSize(NULL, size))) {
+                        char *optr = PyBytes_AS_STRING(out);
+                        Py_BEGIN_ALLOW_THREADS
+                        n = lzjwm_decompress_params(in.buf, in.len, optr, &params);
+                        Py_END_ALLOW_THREADS
+                }
+        }
+        PyBuffer_Release(&in);
+        return finish(out, n, "corrupt compressed data");
+}
+
+/* compress records after blob, which is empty unless appending. */
+static PyObject *records_after(Py_buffer *blob, PyObject *seq, const struct lzjwm_params *params, int terminate,
+                               int keep_nul, int level, unsigned bound)
+{
+        if (!params_ok(params) || !(seq = PySequence_Fast(seq, "records must be a sequence")))
+                return NULL;
+        Py_ssize_t n = PySequence_Fast_GET_SIZE(seq), got = 0;
+        Py_buffer *bufs = PyMem_Calloc(n + 1, sizeof(*bufs));
+        struct lzjwm_input *records = PyMem_Calloc(n + 1, sizeof(*records));
+        struct lzjwm_record *offsets = PyMem_Calloc(n + 1, sizeof(*offsets));
+        PyObject *out = NULL, *list = NULL, *res = NULL;
+        ssize_t size = blob->len, csize = -1;
+        if (!bufs || !records || !offsets) {
+                PyErr_NoMemory();
+                goto done;
+        }
+        for (; got < n; got++) {
+                if (PyObject_GetBuffer(PySequence_Fast_GET_ITEM(seq, got), &bufs[got], PyBUF_SIMPLE) < 0)
+                        goto done;
+                records[got] = (struct lzjwm_input) { bufs[got].buf, bufs[got].len };
+                size += bufs[got].len + (terminate ? 1 : 0);
+        }
+        if (!(out = PyBytes_FromStringAndSize(NULL, size)))
+                goto done;
+        char *optr = PyBytes_AS_STRING(out);
+        int flags = (terminate ? LZJWM_TERMINATE : 0) | (keep_nul ? LZJWM_KEEP_NUL : 0);
+        Py_BEGIN_ALLOW_THREADS
+        csize = lzjwm_append_records(blob->buf, blob->len, records, n, optr, offsets, level, flags, params, bound);
+        Py_END_ALLOW_THREADS
+        if (!(out = finish(out, csize, INPUT_ERROR)) || !(list = PyList_New(n)))
+                goto done;
+        for (Py_ssize_t i = 0; i < n; i++) {
+                PyObject *o = PyLong_FromSize_t(offsets[i].coff);
+                if (!o)
+                        goto done;
+                PyList_SET_ITEM(list, i, o);
+        }
+        res = PyTuple_Pack(2, out, list);
+done:
+        for (Py_ssize_t i = 0; i < got; i++)
+                PyBuffer_Release(&bufs[i]);
+        PyMem_Free(bufs);
+        PyMem_Free(records);
+        PyMem_Free(offsets);
+        Py_XDECREF(out);
+        Py_XDECREF(list);
+        Py_DECREF(seq);
+        return res;
+}
+
+PyDoc_STRVAR(compress_records_doc,
+"compress_records(records, count_bits=2, zero_bits=0, terminate=False, keep_nul=False, level=0, bound=0)\n"
+"    -> (bytes, offsets)\n\n"
+"compress a sequence of records so each can be decoded on its own, offsets\n"
+"is where each starts in the output. terminate puts a null after every\n"
+"record and keep_nul never copies a null.");
+
+static PyObject *compress_records(PyObject *self, PyObject *args, PyObject *kw)
+{
+        static char *kwlist[] = { "records", "count_bits", "zero_bits", "terminate", "keep_nul", "level", "bound", NULL };
+        PyObject *seq;
+        struct lzjwm_params params = LZJWM_DEFAULT_PARAMS;
+        int terminate = 0, keep_nul = 0, level = LZJWM_LEVEL_FAST;
+        unsigned bound = 0;
+        if (!PyArg_ParseTupleAndKeywords(args, kw, "O|iippiI", kwlist, &seq, &params.count_bits, &params.zero_bits,
+                                         &terminate, &keep_nul, &level, &bound))
+                return NULL;
+        Py_buffer blob = { .buf = "", .len = 0 };
+        return records_after(&blob, seq, &params, terminate, keep_nul, level, bound);
+}
+
+PyDoc_STRVAR(append_records_doc,
+"append_records(blob, records, count_bits=2, zero_bits=0, terminate=False, keep_nul=False, level=0, bound=0)\n"
+"    -> (bytes, offsets)\n\n"
+"like compress_records but the records go after blob, records compressed\n"
+"before with the same settings, and may copy from its tail. the bytes are\n"
+"blob with the new records after it and offsets count from its start.");
+
+static PyObject *append_records(PyObject *self, PyObject *args, PyObject *kw)
+{
+        static char *kwlist[] = { "blob", "records", "count_bits", "zero_bits", "terminate", "keep_nul", "level", "bound",
+                                  NULL };
+        Py_buffer blob;
+        PyObject *seq;
+        struct lzjwm_params params = LZJWM_DEFAULT_PARAMS;
+        int terminate = 0, keep_nul = 0, level = LZJWM_LEVEL_FAST;
+        unsigned bound = 0;
+        if (!PyArg_ParseTupleAndKeywords(args, kw, "y*O|iippiI", kwlist, &blob, &seq, &params.count_bits,
+                                         &params.zero_bits, &terminate, &keep_nul, &level, &bound))
+                return NULL;
+        PyObject *res = records_after(&blob, seq, &params, terminate, keep_nul, level, bound);
+        PyBuffer_Release(&blob);
+        return res;
+}
+
+static PyMethodDef methods[] = {
+        { "compress", (PyCFunction)(void (*)(void))compress, METH_VARARGS | METH_KEYWORDS, compress_doc },
+        { "decompress", (PyCFunction)(void (*)(void))decompress, METH_VARARGS | METH_KEYWORDS, decompress_doc },
+        { "compress_records", (PyCFunction)(void (*)(void))compress_records, METH_VARARGS | METH_KEYWORDS,
+          compress_records_doc },
+        { "append_records", (PyCFunction)(void (*)(void))append_records, METH_VARARGS | METH_KEYWORDS,
+          append_records_doc },
+        { NULL }
+};
+
+static struct PyModuleDef module = {
+        PyModuleDef_HEAD_INIT,
+        .m_name = "_lzjwm",
+        .m_doc = "the C lzjwm encoder and decoder",
+        .m_size = -1,
+        .m_methods = methods,
+};
+
+PyMODINIT_FUNC PyInit__lzjwm(void)
+{
+        return PyModule_Create(&module);
+}
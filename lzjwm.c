@@ -1,9 +1,11 @@
 #include <assert.h>
+#include <err.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
 #include <unistd.h>
+#include <getopt.h>
 #include <stdint.h>
 #include <inttypes.h>
 
@@ -22,47 +24,517 @@
  * usage, this alwayws works with stdin and stdout
  *
  * -x dump encoded data in text format for debugging
- * -c compress data
+ * -c compress data, at the fast level this streams in constant memory
  * -d decompress data
  * -v print parameters of encoding
  * -S decompress via the streaming method
+ * -F decompress via the vectorized decoder
+ * -R decompress via the ring buffer streaming decoder
+ * -L level compression level, 0 is fast greedy up to 3 for smallest output
+ * -j n use n threads, compressing in independent blocks or decompressing in
+ *      slices
+ * -b size block size for -j, default 1MiB
+ * -i file write the uncompressed and compressed offset of each block to file
+ * -r off,len decompress only len bytes starting at uncompressed offset off
+ * -C bits number of count bits, the data must be decoded with the same -C
+ * -Z bits number of zero bits, the same
+ *      only -c, -d, -R, -v and -a work with a format other than the default, see
+ *      LZJWM_FORMATS for the supported ones.
+ * -B bound when compressing, never let the recursive decoder read more than bound
+ *      bytes per character to decode any byte
+ * --tune compress with every supported format on -j threads at level -L and
+ *      print the size, cpu time and decode work of each to stderr. the best is
+ *      written out as a header defining COUNT_BITS and ZERO_BITS, include it
+ *      before lzjwm.h or tiny_lzjwm.c to build a decoder for it.
+ * -a analyze compressed data, print as JSON how many compressed bytes the
+ *      recursive decoder reads and how deep it recurses for each record, along
+ *      with a histogram of the bytes read.
+ * --records file the records for -a, a line with the compressed offset and
+ *      length of each, by default the whole input is one record
+ * --budget n with -a, exit with status 2 if any record reads more than n bytes
+ * -l with -c, treat each line of the input as its own record, each can be
+ *      decoded on its own starting at its compressed offset
+ * -0 with -c, put a null after every record
+ * -z with -c, never copy a null so it appears unchanged in the compressed data
+ * -f format with -c, write raw compressed data or, as lzjwm.py does, a c or
+ *      c_avr header or yaml with the compressed offset of each record
+ * --train build a dictionary from sample messages, one per line, at level -L
+ *      and write it out. how well each sample compresses on its own with and
+ *      without it is printed to stderr.
+ * -D dict with -c or -d, compress or decompress using a dictionary made by
+ *      --train, the same one has to be given to both
+ * --optimize read compressed data and write it out again as small as it can
+ *      be found by parsing it at every level and then over and over, each time
+ *      ruling out one of the copies in the best so far. it goes on until
+ *      nothing more is found or for --time seconds.
  */
 
-#define PI(x) printf("%1$-16s = %2$" PRIiMAX "\n", #x, (intmax_t)(x))
+enum { OPT_TUNE = 256, OPT_RECORDS, OPT_BUDGET, OPT_TRAIN, OPT_OPTIMIZE, OPT_TIME };
+
+static const struct option long_options[] = {
+        { "tune", no_argument, NULL, OPT_TUNE },
+        { "records", required_argument, NULL, OPT_RECORDS },
+        { "budget", required_argument, NULL, OPT_BUDGET },
+        { "train", no_argument, NULL, OPT_TRAIN },
+        { "optimize", no_argument, NULL, OPT_OPTIMIZE },
+        { "time", required_argument, NULL, OPT_TIME },
+        { NULL }
+};
+
+/* the histogram puts a record reading n bytes in the bucket for the number
+ * of bits in n */
+#define HIST_BUCKETS 65
+
+static int bits(size_t n)
+{
+        int b = 0;
+        for (; n; n >>= 1)
+                b++;
+        return b;
+}
+
+static int analyze(const char *in, size_t isize, const struct lzjwm_params *params,
+                   const char *records_file, size_t budget)
+{
+        rb_t records = RB_BLANK;
+        if (records_file) {
+                FILE *fh = fopen(records_file, "r");
+                if (!fh)
+                        err(1, "%s", records_file);
+                struct lzjwm_record r;
+                while (fscanf(fh, "%zu %zu", &r.coff, &r.len) == 2)
+                        RB_LPUSH(&records, r);
+                if (!feof(fh))
+                        errx(1, "%s: expected lines of offset and length", records_file);
+                fclose(fh);
+        } else {
+                struct lzjwm_record r = { 0, lzjwm_decompressed_size_params(in, isize, params) };
+                RB_LPUSH(&records, r);
+        }
+        size_t n = RB_NITEMS(struct lzjwm_record, &records);
+        struct lzjwm_record *rs = rb_ptr(&records);
+        struct lzjwm_record_work *work = malloc((n + 1) * sizeof(*work));
+        if (!work || lzjwm_analyze(in, isize, params, rs, n, work) < 0)
+                errx(1, "records don't fit the data");
+        size_t hist[HIST_BUCKETS] = { 0 }, max_touched = 0, max_depth = 0, over = 0;
+        for (size_t i = 0; i < n; i++) {
+                hist[bits(work[i].touched)]++;
+                if (work[i].touched > max_touched)
+                        max_touched = work[i].touched;
+                if (work[i].depth > max_depth)
+                        max_depth = work[i].depth;
+                if (budget && work[i].touched > budget)
+                        over++;
+        }
+        printf("{\n  \"compressed_size\": %zu,\n  \"records\": %zu,\n", isize, n);
+        printf("  \"max_touched\": %zu,\n  \"max_depth\": %zu,\n", max_touched, max_depth);
+        if (budget)
+                printf("  \"budget\": %zu,\n  \"over_budget\": %zu,\n", budget, over);
+        printf("  \"histogram\": [");
+        const char *sep = "";
+        for (int b = 0; b < HIST_BUCKETS; b++) {
+                if (!hist[b])
+                        continue;
+                printf("%s\n    {\"touched_min\": %zu, \"touched_max\": %zu, \"records\": %zu}", sep,
+                       b ? (size_t)1 << (b - 1) : 0, b ? ((size_t)1 << (b - 1)) * 2 - 1 : 0, hist[b]);
+                sep = ",";
+        }
+        printf("\n  ],\n  \"work\": [");
+        for (size_t i = 0; i < n; i++)
+                printf("%s\n    {\"offset\": %zu, \"length\": %zu, \"touched\": %zu, \"depth\": %zu}", i ? "," : "",
+                       rs[i].coff, rs[i].len, work[i].touched, work[i].depth);
+        printf("\n  ]\n}\n");
+        free(work);
+        rb_free(&records);
+        return over ? 2 : 0;
+}
+
+static const char b64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/* base64 in lines of 76 characters, the way yaml writes binary */
+static void print_base64(const uint8_t *in, size_t len)
+{
+        for (size_t i = 0; i < len; i += 57) {
+                printf("    ");
+                for (size_t j = i; j < i + 57 && j < len; j += 3) {
+                        uint32_t v = in[j] << 16 | (j + 1 < len ? in[j + 1] << 8 : 0) | (j + 2 < len ? in[j + 2] : 0);
+                        for (int k = 0; k < 4; k++)
+                                putchar(k <= len - j ? b64[(v >> (18 - 6 * k)) & 63] : '=');
+                }
+                putchar('\n');
+        }
+}
+
+/* write c as it would appear in a c string, returns its length */
+static int escape(char *buf, uint8_t c)
+{
+        static const char from[] = "\a\b\f\n\r\t\v\\\"", to[] = "abfnrtv\\\"";
+        const char *e = c ? strchr(from, c) : NULL;
+        if (e)
+                return sprintf(buf, "\\%c", to[e - from]);
+        if (c >= ' ' && c < 0x7f) {
+                *buf = c;
+                return 1;
+        }
+        return sprintf(buf, "\\%03o", c);
+}
+
+/* records are named by their line number with -l, otherwise the one record
+ * is named after stdin like lzjwm.py does. */
+static void print_records(const char *out, size_t csize, const struct lzjwm_input *records, size_t n,
+                          const struct lzjwm_record *offsets, bool lines, int flags, const char *format)
+{
+        char name[32];
+        if (!strcmp(format, "yaml")) {
+                printf("compressed_length: %zu\n", csize);
+                printf("parts:%s\n", n ? "" : " []");
+                for (size_t i = 0, uoff = 0; i < n; i++) {
+                        if (lines)
+                                snprintf(name, sizeof(name), "%zu", i);
+                        printf("-   compressed_offset: %zu\n    length: %zu\n    name: %s\n    offset: %zu\n",
+                               offsets[i].coff, offsets[i].len, lines ? name : "<stdin>", uoff);
+                        uoff += records[i].len + (flags & LZJWM_TERMINATE ? 1 : 0);
+                }
+                if (csize) {
+                        printf("raw: !!binary |\n");
+                        print_base64((const uint8_t *)out, csize);
+                } else
+                        printf("raw: !!binary \"\"\n");
+                return;
+        }
+        printf("#ifndef LZJWM_DATA_H\n#define LZJWM_DATA_H\n\n");
+        if (!strcmp(format, "c_avr"))
+                printf("#include <avr/pgmspace.h>\n\n");
+        for (size_t i = 0; i < n; i++) {
+                if (lines)
+                        snprintf(name, sizeof(name), "%zu", i);
+                else
+                        strcpy(name, "_STDIN_");
+                printf("#define OFFSET_%s %zu\n#define LENGTH_%s %zu\n\n", name, offsets[i].coff, name, offsets[i].len);
+        }
+        printf("static const char lzjwm_data[]%s = ", strcmp(format, "c_avr") ? "" : " PROGMEM");
+        if (!csize)
+                printf("\"\";");
+        /* lines are filled until they reach 80 characters */
+        for (size_t i = 0; i < csize;) {
+                char line[96];
+                int len = 0;
+                while (len < 80 && i < csize)
+                        len += escape(line + len, out[i++]);
+                printf("\n    \"%.*s\"%s", len, line, i < csize ? "" : ";");
+        }
+        printf("\n\n#endif\n");
+}
+
+/* lines end at \n, \r or \r\n and the last one needn't end at all */
+static void split_lines(const char *in, size_t isize, rb_t *records)
+{
+        for (const char *p = in, *end = in + isize; p < end;) {
+                const char *e = p;
+                while (e < end && *e != '\n' && *e != '\r')
+                        e++;
+                struct lzjwm_input r = { p, e - p };
+                RB_LPUSH(records, r);
+                if (e + 1 < end && e[0] == '\r' && e[1] == '\n')
+                        e++;
+                p = e + 1;
+        }
+}
+
+static int compress_records(const char *in, size_t isize, bool lines, int flags, const char *format, int level,
+                            const struct lzjwm_params *params, unsigned bound)
+{
+        rb_t records = RB_BLANK;
+        if (lines)
+                split_lines(in, isize, &records);
+        else {
+                struct lzjwm_input r = { in, isize };
+                RB_LPUSH(&records, r);
+        }
+        size_t n = RB_NITEMS(struct lzjwm_input, &records);
+        struct lzjwm_record *offsets = malloc((n + 1) * sizeof(*offsets));
+        char *out = malloc(isize + n + 1);
+        ssize_t csize = -1;
+        if (offsets && out)
+                csize = lzjwm_compress_records(rb_ptr(&records), n, out, offsets, level, flags, params, bound);
+        if (csize < 0)
+                errx(1, "could not compress the input");
+        fprintf(stderr, "compressing: %li -> %li (%.2f%%)\n", (long)isize, (long)csize, (1.0 - (float)csize / (float)isize) * 100.0);
+        if (!strcmp(format, "raw"))
+                fwrite(out, 1, csize, stdout);
+        else
+                print_records(out, csize, rb_ptr(&records), n, offsets, lines, flags, format);
+        free(offsets);
+        free(out);
+        rb_free(&records);
+        return 0;
+}
+
+static int train(const char *in, size_t isize, int level, const struct lzjwm_params *params)
+{
+        rb_t samples = RB_BLANK;
+        split_lines(in, isize, &samples);
+        size_t n = RB_NITEMS(struct lzjwm_input, &samples);
+        const struct lzjwm_input *s = rb_ptr(&samples);
+        char dict[LZJWM_LOOKBACK(1, 0)];
+        ssize_t dsize = lzjwm_train_dict(s, n, dict, level, params);
+        lzjwm_ctx_t *ctx = lzjwm_ctx_new(NULL, 0);
+        char *out = malloc(isize + 1);
+        if (dsize < 0 || !ctx || !out)
+                errx(1, "could not train a dictionary");
+        size_t total = 0, alone = 0, with = 0;
+        for (size_t i = 0; i < n; i++) {
+                ssize_t a = lzjwm_ctx_compress_params(ctx, s[i].data, s[i].len, out, level, params);
+                ssize_t w = lzjwm_ctx_compress_with_dict(ctx, dict, dsize, s[i].data, s[i].len, out, level, params);
+                total += s[i].len;
+                alone += a < 0 ? s[i].len : a;
+                with += w < 0 ? s[i].len : w;
+        }
+        fprintf(stderr, "dictionary: %zi bytes, %zu samples of %zu bytes compress to %zu alone and %zu with it (%.2f%%)\n",
+                dsize, n, total, alone, with, alone ? (1.0 - (float)with / (float)alone) * 100.0 : 0.0);
+        fwrite(dict, 1, dsize, stdout);
+        lzjwm_ctx_free(ctx);
+        free(out);
+        rb_free(&samples);
+        return 0;
+}
+
+static void write_stdout(void *user, const char *buf, size_t len)
+{
+        fwrite(buf, 1, len, user);
+}
+
+#define PI(n, x) printf("%1$-16s = %2$" PRIiMAX "\n", n, (intmax_t)(x))
 
 int main(int argc, char *argv[])
 {
         rb_t rb = RB_BLANK;
-        int opt, mode = 'd';
-        while ((opt = getopt(argc, argv, "nvpdcxS")) != -1)
-                mode = opt;
+        int opt, mode = 'd', level = LZJWM_LEVEL_FAST, nthreads = 0;
+        size_t block_size = 1 << 20;
+        char *index_file = NULL;
+        size_t range_off = 0, range_len = 0;
+        struct lzjwm_params params = LZJWM_DEFAULT_PARAMS;
+        unsigned bound = 0;
+        char *records_file = NULL;
+        size_t budget = 0;
+        bool lines = false;
+        int flags = 0;
+        const char *format = "raw";
+        char *dict_file = NULL;
+        double seconds = 0;
+        while ((opt = getopt_long(argc, argv, "nvpdcxaSFRl0zL:j:b:i:r:C:Z:B:f:D:", long_options, NULL)) != -1) {
+                switch (opt) {
+                case 'l':
+                        lines = true;
+                        break;
+                case '0':
+                        flags |= LZJWM_TERMINATE;
+                        break;
+                case 'z':
+                        flags |= LZJWM_KEEP_NUL;
+                        break;
+                case 'f':
+                        if (strcmp(optarg, "raw") && strcmp(optarg, "c") && strcmp(optarg, "c_avr") && strcmp(optarg, "yaml"))
+                                errx(1, "-f must be raw, c, c_avr or yaml");
+                        format = optarg;
+                        break;
+                case 'C':
+                        params.count_bits = atoi(optarg);
+                        break;
+                case 'Z':
+                        params.zero_bits = atoi(optarg);
+                        break;
+                case OPT_TUNE:
+                        mode = 'T';
+                        break;
+                case OPT_TRAIN:
+                        mode = 't';
+                        break;
+                case 'D':
+                        dict_file = optarg;
+                        break;
+                case OPT_OPTIMIZE:
+                        mode = 'o';
+                        break;
+                case OPT_TIME:
+                        seconds = atof(optarg);
+                        break;
+                case OPT_RECORDS:
+                        records_file = optarg;
+                        break;
+                case OPT_BUDGET:
+                        budget = strtoull(optarg, NULL, 0);
+                        break;
+                case 'B':
+                        bound = strtoul(optarg, NULL, 0);
+                        if (!bound)
+                                errx(1, "-B must be at least 1");
+                        break;
+                case 'L':
+                        level = atoi(optarg);
+                        break;
+                case 'j':
+                        nthreads = atoi(optarg);
+                        break;
+                case 'b':
+                        block_size = strtoull(optarg, NULL, 0);
+                        if (!block_size)
+                                errx(1, "-b must be above 0");
+                        break;
+                case 'i':
+                        index_file = optarg;
+                        break;
+                case 'r':
+                        if (sscanf(optarg, "%zu,%zu", &range_off, &range_len) != 2)
+                                errx(1, "-r expects offset,length");
+                        mode = opt;
+                        break;
+                default:
+                        mode = opt;
+                }
+        }
+        if (!lzjwm_params_ok(&params))
+                errx(1, "unsupported format -C %i -Z %i", params.count_bits, params.zero_bits);
+        int cb = params.count_bits, zb = params.zero_bits;
+        if ((cb != COUNT_BITS || zb != ZERO_BITS)
+            && (!strchr("cdRvato", mode) || nthreads || index_file))
+                errx(1, "only -c, -d, -R, -v, -a, --train and --optimize can use -C and -Z");
         if (mode == 'v') {
-                PI(COUNT_BITS);
-                PI(MAX_MATCH);
-                PI(MAX_ZERO_MATCH);
-                PI(LOOKBACK);
-                PI(ZERO_BITS);
+                PI("COUNT_BITS", cb);
+                PI("MAX_MATCH", LZJWM_MAX_MATCH(cb));
+                PI("MAX_ZERO_MATCH", LZJWM_MAX_ZERO_MATCH(cb, zb));
+                PI("LOOKBACK", LZJWM_LOOKBACK(cb, zb));
+                PI("ZERO_BITS", zb);
+                exit(0);
+        }
+        if (bound && (mode != 'c' || nthreads || index_file))
+                errx(1, "-B only works with -c");
+        bool records = lines || flags || strcmp(format, "raw");
+        if (records && (mode != 'c' || nthreads || index_file))
+                errx(1, "-l, -0, -z and -f only work with -c");
+        rb_t dict = RB_BLANK;
+        if (dict_file && (!strchr("cd", mode) || nthreads || index_file || bound || records))
+                errx(1, "-D only works with -c and -d");
+        if (dict_file && rb_read_file(&dict, dict_file) < 0)
+                exit(1);
+        if (mode == 'c' && level <= LZJWM_LEVEL_FAST && !nthreads && !index_file && !bound && !records && !dict_file) {
+                /* nothing else needs all the input at once so stream it */
+                struct lzjwm_cstream *cs = lzjwm_cstream_init_params(level, &params, write_stdout, stdout);
+                if (!cs)
+                        exit(1);
+                char buf[65536];
+                size_t n, total = 0;
+                while ((n = fread(buf, 1, sizeof(buf), stdin)) > 0) {
+                        if (lzjwm_cstream_feed(cs, buf, n) < 0)
+                                errx(1, "input is not 7 bit");
+                        total += n;
+                }
+                ssize_t nsz = lzjwm_cstream_finish(cs);
+                if (nsz < 0)
+                        exit(1);
+                fprintf(stderr, "compressing: %li -> %li (%.2f%%)\n", (long)total, (long)nsz, (1.0 - (float)nsz / (float)total) * 100.0);
                 exit(0);
         }
         if (rb_fread(&rb, stdin, -1) < 0)
                 exit(1);
+        if (records)
+                exit(compress_records(rb_ptr(&rb), rb_len(&rb), lines, flags, format, level, &params, bound));
         switch (mode) {
+        case 't':
+                exit(train(rb_ptr(&rb), rb_len(&rb), level, &params));
+        case 'o': {
+                struct lzjwm_optimize_stats stats;
+                char *out = malloc(rb_len(&rb) + 1);
+                ssize_t nsz = out ? lzjwm_optimize(rb_ptr(&rb), rb_len(&rb), out, &params, seconds, &stats) : -1;
+                if (nsz < 0)
+                        errx(1, "could not optimize the input, is it compressed with the same -C and -Z?");
+                fprintf(stderr, "optimizing: %zu -> %zi bytes in %zu rounds, %zu better, %.2fs, %s\n", rb_len(&rb),
+                        nsz, stats.rounds, stats.improved, stats.seconds,
+                        stats.converged ? "nothing more found" : "out of time");
+                fwrite(out, 1, nsz, stdout);
+                exit(0);
+        }
+        case 'a':
+                exit(analyze(rb_ptr(&rb), rb_len(&rb), &params, records_file, budget));
+        case 'T': {
+                struct lzjwm_tune results[LZJWM_NFORMATS];
+                int best = lzjwm_tune(rb_ptr(&rb), rb_len(&rb), level, nthreads, results);
+                if (best < 0)
+                        errx(1, "could not compress the input");
+                fprintf(stderr, "  cb zb      size   ratio   cpu ms  work/char  max work  depth\n");
+                for (int f = 0; f < LZJWM_NFORMATS; f++) {
+                        const struct lzjwm_tune *r = &results[f];
+                        if (r->size < 0)
+                                continue;
+                        fprintf(stderr, "%c %2i %2i %9zi %7.4f %8.2f %10.3f %9zu %6zu\n", f == best ? '*' : ' ',
+                                r->params.count_bits, r->params.zero_bits, r->size,
+                                rb_len(&rb) ? (double)r->size / rb_len(&rb) : 1.0, r->seconds * 1e3,
+                                rb_len(&rb) ? (double)r->work.total / rb_len(&rb) : 0.0, r->work.max, r->work.depth);
+                }
+                printf("/* lzjwm --tune: %zu -> %zi bytes at level %i */\n", rb_len(&rb), results[best].size, level);
+                printf("#define COUNT_BITS %i\n", results[best].params.count_bits);
+                printf("#define ZERO_BITS %i\n", results[best].params.zero_bits);
+                exit(0);
+        }
         case 'x':
                 lzjwm_dump(rb_ptr(&rb), rb_len(&rb));
                 exit(0);
-        case 'S':
-                lzjwm_decompress_stream(rb_ptr(&rb), rb_len(&rb), (int (*)(int, void *))fputc, stdout);
+        case 'S': {
+                char buf[4096];
+                lzjwm_decompress_stream_buf(rb_ptr(&rb), rb_len(&rb), buf, sizeof(buf), write_stdout, stdout);
+                exit(0);
+        }
+        case 'R':
+                lzjwm_decompress_ring_params(rb_ptr(&rb), rb_len(&rb), &params, write_stdout, stdout);
                 exit(0);
         }
         rb_t rbo = RB_BLANK;
-        if (mode == 'd') {
+        if (mode == 'r') {
+                struct lzjwm_index index;
+                if (lzjwm_index_build(rb_ptr(&rb), rb_len(&rb), 4096, &index) < 0)
+                        exit(1);
+                rb_resize(&rbo, range_len, false);
+                rb_resize(&rbo, lzjwm_decompress_range(rb_ptr(&rb), rb_len(&rb), &index, range_off, range_len, rb_ptr(&rbo)), true);
+                lzjwm_index_free(&index);
+        } else if (mode == 'F') {
                 size_t dsize = lzjwm_decompressed_size(rb_ptr(&rb), rb_len(&rb));
+                rb_resize(&rbo, dsize + LZJWM_SLACK, false);
+                rb_resize(&rbo, lzjwm_decompress_fast(rb_ptr(&rb), rb_len(&rb), rb_ptr(&rbo)), true);
+        } else if (mode == 'd') {
+                size_t dsize = lzjwm_decompressed_size_params(rb_ptr(&rb), rb_len(&rb), &params);
                 rb_resize(&rbo, dsize, false);
-                if (lzjwm_decompress(rb_ptr(&rb), rb_len(&rb), rb_ptr(&rbo)) < 0)
+                if (dict_file)
+                        lzjwm_decompress_with_dict(rb_ptr(&dict), rb_len(&dict), rb_ptr(&rb), rb_len(&rb), rb_ptr(&rbo),
+                                                   &params);
+                else if (nthreads)
+                        lzjwm_decompress_parallel(rb_ptr(&rb), rb_len(&rb), rb_ptr(&rbo), nthreads);
+                else
+                        lzjwm_decompress_params(rb_ptr(&rb), rb_len(&rb), rb_ptr(&rbo), &params);
+        } else if (nthreads || index_file) {
+                size_t nblocks = (rb_len(&rb) + block_size - 1) / block_size;
+                struct lzjwm_offset *index = malloc(nblocks * sizeof(*index));
+                if (!index && nblocks)
+                        err(1, "malloc");
+                rb_resize(&rbo, rb_len(&rb), false);
+                ssize_t nsz = lzjwm_compress_parallel(rb_ptr(&rb), rb_len(&rb), nthreads, block_size, level, rb_ptr(&rbo), index);
+                if (nsz < 0)
                         exit(1);
+                rb_resize(&rbo, nsz, true);
+                if (index_file) {
+                        FILE *fh = fopen(index_file, "w");
+                        if (!fh)
+                                err(1, "%s", index_file);
+                        for (size_t i = 0; i < nblocks; i++)
+                                fprintf(fh, "%zu %zu\n", index[i].uoff, index[i].coff);
+                        fclose(fh);
+                }
+                free(index);
         } else {
                 rb_resize(&rbo, rb_len(&rb), false);
-                ssize_t nsz = lzjwm_compress(rb_ptr(&rb), rb_len(&rb), rb_ptr(&rbo));
+                ssize_t nsz = bound ? lzjwm_compress_bounded(rb_ptr(&rb), rb_len(&rb), rb_ptr(&rbo), level, &params, bound)
+                            : dict_file ? lzjwm_compress_with_dict(rb_ptr(&dict), rb_len(&dict), rb_ptr(&rb), rb_len(&rb),
+                                                                   rb_ptr(&rbo), level, &params)
+                                        : lzjwm_compress_params(rb_ptr(&rb), rb_len(&rb), rb_ptr(&rbo), level, &params);
                 if (nsz < 0)
                         exit(1);
                 rb_resize(&rbo, nsz, true);
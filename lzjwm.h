@@ -27,41 +27,410 @@
  */
 
 #include<stdlib.h>
+#include<stdbool.h>
+#include<sys/types.h>
 
-/* steal ZERO_BITS bits for COUNT_BITS for special encoding of offset = 0*/
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* steal ZERO_BITS bits for COUNT_BITS for special encoding of offset = 0.
+ * both may be defined before this is included, lzjwm --tune writes out a
+ * header that does so. */
+#ifndef ZERO_BITS
 #define ZERO_BITS 0
+#endif
+#ifndef COUNT_BITS
 #define COUNT_BITS 2 
+#endif
 
-#define LOOKBACK ((1 << (7 - COUNT_BITS)) - (ZERO_BITS ? (1 << ZERO_BITS) : 0))
-#define MAX_MATCH ((1 << COUNT_BITS) + 1)
-#define MAX_ZERO_MATCH ((1 << (COUNT_BITS + ZERO_BITS)) + 1)
+#define LZJWM_LOOKBACK(cb, zb) ((1 << (7 - (cb))) - ((zb) ? (1 << (zb)) : 0))
+#define LZJWM_MAX_MATCH(cb) ((1 << (cb)) + 1)
+#define LZJWM_MAX_ZERO_MATCH(cb, zb) ((1 << ((cb) + (zb))) + 1)
+
+#define LOOKBACK LZJWM_LOOKBACK(COUNT_BITS, ZERO_BITS)
+#define MAX_MATCH LZJWM_MAX_MATCH(COUNT_BITS)
+#define MAX_ZERO_MATCH LZJWM_MAX_ZERO_MATCH(COUNT_BITS, ZERO_BITS)
 
 #define COUNT(x) (((x) & ((1 << COUNT_BITS) - 1)) + 2)
 #define OFFSET(x) (((x) & 0x7f) >> COUNT_BITS)
 
+/* the formats the library can handle at runtime besides the one fixed above,
+ * X(count_bits, zero_bits) for each. it has to include COUNT_BITS and
+ * ZERO_BITS. */
+#define LZJWM_FORMATS(X) \
+        X(1, 0) X(1, 1) X(1, 2) \
+        X(2, 0) X(2, 1) X(2, 2) \
+        X(3, 0) X(3, 1) X(3, 2) \
+        X(4, 0) X(4, 1) \
+        X(5, 0)
+
+/* choose a format at runtime. the _params versions of the functions below
+ * take one of these, NULL means COUNT_BITS and ZERO_BITS. data has to be
+ * decoded with the same params it was encoded with, nothing in the stream
+ * says what they were. */
+struct lzjwm_params {
+        int count_bits, zero_bits;
+};
+
+#define LZJWM_DEFAULT_PARAMS { COUNT_BITS, ZERO_BITS }
+
+/* whether params is one of LZJWM_FORMATS, the _params functions fail with -1
+ * or 0 if not. */
+bool lzjwm_params_ok(const struct lzjwm_params *params);
+
+
+/* a pair of corresponding positions in the uncompressed and compressed data,
+ * decoding may start at coff and will produce data from uoff on. */
+struct lzjwm_offset {
+        size_t uoff, coff;
+};
 
 /* get size of uncompressed data given a compressed data block. 
  * isize should be size of data or if -1 is passed in it will
  * assume the data is null terminated */
 size_t lzjwm_decompressed_size(const char *in, ssize_t isize);
+size_t lzjwm_decompressed_size_params(const char *in, ssize_t isize, const struct lzjwm_params *params);
 
 /* this calls putc(character,user) for each decoded character in the stream. 
  * isize should  be the size of the input, or -1 if the input is null terminated. 
  * returns the number of characters decoded. */
 size_t lzjwm_decompress_stream(const char *in, ssize_t isize, int (*putc)(int c, void *data), void *user);
 
+/* the same as lzjwm_decompress_stream, but output is gathered into buf and
+ * passed to write(user, buf, len) each time bufsize characters have built up
+ * and once more at the end. buf can be as small as you like, no other buffer
+ * is needed. */
+size_t lzjwm_decompress_stream_buf(const char *in, ssize_t isize, char *buf, size_t bufsize,
+                                   void (*write)(void *user, const char *buf, size_t len), void *user);
+
+/* streaming decompression in linear time and constant memory. matches are
+ * copied from a small ring of recent output instead of being decoded again
+ * recursively, the output is passed to write(user, buf, len) in chunks from
+ * that ring. isize may be -1 for null terminated input. */
+size_t lzjwm_decompress_ring(const char *in, ssize_t isize,
+                             void (*write)(void *user, const char *buf, size_t len), void *user);
+size_t lzjwm_decompress_ring_params(const char *in, ssize_t isize, const struct lzjwm_params *params,
+                                    void (*write)(void *user, const char *buf, size_t len), void *user);
+
 /* decompress into a static buffer. out must have enough space, call
  * lzjwm_decompressed_size to get the size of buffer needed if you don't know it
  * this will be faster than the streaming version as it can use the outgoing
  * buffer as a cache. */
 size_t lzjwm_decompress(const char *in, ssize_t isize,  char *out);
+size_t lzjwm_decompress_params(const char *in, ssize_t isize, char *out, const struct lzjwm_params *params);
+
+/* how many bytes past the end of the decompressed data lzjwm_decompress_fast
+ * may write to. */
+#define LZJWM_SLACK 32
+
+/* the same as lzjwm_decompress, but literals are copied a vector at a time and
+ * matches with a single wide copy. the best of avx2, sse2, neon or plain 64 bit
+ * words is picked at runtime. out must have LZJWM_SLACK bytes of room past the
+ * decompressed size and the input may not be null terminated. */
+size_t lzjwm_decompress_fast(const char *in, size_t isize, char *out);
+
+/* decompress using nthreads threads, nthreads <= 0 uses one per cpu. the input
+ * is split into slices, the decoded size of each is summed up to find where
+ * its output goes, then they are all decoded at once straight into out.
+ * works on any stream, not just ones from lzjwm_compress_parallel. */
+size_t lzjwm_decompress_parallel(const char *in, size_t isize, char *out, int nthreads);
+
+/* decode only the compressed bytes from start up to end. out should point at
+ * where the output of in[start] belongs, data before it is never read so
+ * slices may be decoded independently. returns the number of bytes written. */
+size_t lzjwm_decompress_slice(const char *in, size_t start, size_t end, char *out);
+
+/* a sparse index for random access by uncompressed offset. points[k] is the
+ * input byte whose output covers uncompressed offset k * interval. */
+struct lzjwm_index {
+        size_t interval, npoints;
+        struct lzjwm_offset *points;
+};
+
+/* build an index with a checkpoint every interval bytes of output, returns -1
+ * on failure. free it with lzjwm_index_free. */
+int lzjwm_index_build(const char *in, size_t isize, size_t interval, struct lzjwm_index *index);
+void lzjwm_index_free(struct lzjwm_index *index);
+
+/* decode len bytes of output starting at uncompressed offset uoff into out.
+ * decoding starts from the nearest checkpoint before uoff in index, or the
+ * beginning if index is NULL. returns the number of bytes written, which is
+ * less than len if the data ends first. */
+size_t lzjwm_decompress_range(const char *in, size_t isize, const struct lzjwm_index *index,
+                              size_t uoff, size_t len, char *out);
 
 /* compress data.
  * see the python version for more features.
  * out must be as big as in, returns a negative number on error */
 ssize_t lzjwm_compress(const char *in, size_t isize, char *out);
 
+/* compression levels.
+ * fast is the plain greedy algorithm used by lzjwm_compress. higher levels try
+ * alternatives to every match found by playing the greedy algorithm forward
+ * and keeping whichever choice packed the most data in. each level looks twice
+ * as far ahead as the one before, they are many times slower but produce
+ * smaller output that is still readable by every decoder. */
+#define LZJWM_LEVEL_FAST 0
+#define LZJWM_LEVEL_BEST 3
+#define LZJWM_LEVEL_MAX  3
+
+ssize_t lzjwm_compress_level(const char *in, size_t isize, char *out, int level);
+ssize_t lzjwm_compress_params(const char *in, size_t isize, char *out, int level, const struct lzjwm_params *params);
+
+/* streaming compression for input of any size in a fixed amount of memory.
+ * only a small window of input past the last character written out is held,
+ * output is passed to write(user, buf, len) in chunks as it becomes final.
+ *
+ * the result is exactly what lzjwm_compress_level would produce from all the
+ * input at once, except that higher levels don't fall back to the greedy
+ * result when it happens to be smaller since that would need two passes.
+ *
+ * lzjwm_cstream_init returns NULL if it can't allocate memory. feed returns
+ * -1 on invalid input, after which the stream is useless. finish flushes
+ * everything out, frees the stream and returns the total compressed size or
+ * -1 if there was an error. */
+struct lzjwm_cstream;
+struct lzjwm_cstream *lzjwm_cstream_init(int level, void (*write)(void *user, const char *buf, size_t len), void *user);
+struct lzjwm_cstream *lzjwm_cstream_init_params(int level, const struct lzjwm_params *params,
+                                                void (*write)(void *user, const char *buf, size_t len), void *user);
+int lzjwm_cstream_feed(struct lzjwm_cstream *cs, const char *in, size_t len);
+ssize_t lzjwm_cstream_finish(struct lzjwm_cstream *cs);
+
+/* a compression context holds all the memory the compressor needs so it can
+ * be reused to compress many small inputs without allocating each time. it
+ * does not depend on the size of the input, it is about 350k with the rings
+ * sized for every level and format.
+ *
+ * lzjwm_ctx_new allocates one if mem is NULL, otherwise it is placed in the
+ * msize bytes at mem, which must be 8 byte aligned and at least
+ * lzjwm_ctx_size() bytes. it returns NULL if that isn't possible.
+ * lzjwm_ctx_compress is the same as lzjwm_compress_level but uses ctx and
+ * doesn't allocate anything. a stream from lzjwm_cstream_init is a context
+ * too. */
+typedef struct lzjwm_cstream lzjwm_ctx_t;
+size_t lzjwm_ctx_size(void);
+lzjwm_ctx_t *lzjwm_ctx_new(void *mem, size_t msize);
+void lzjwm_ctx_free(lzjwm_ctx_t *ctx);
+ssize_t lzjwm_ctx_compress(lzjwm_ctx_t *ctx, const char *in, size_t isize, char *out, int level);
+ssize_t lzjwm_ctx_compress_params(lzjwm_ctx_t *ctx, const char *in, size_t isize, char *out, int level,
+                                  const struct lzjwm_params *params);
+
+/* compress so that decoding any byte in full never has the recursive decoder
+ * in tiny_lzjwm.c read more than bound compressed bytes for each character it
+ * stands for, as measured by lzjwm_decode_work. copies that cost more are
+ * ruled out and the input compressed again until none are left, so this
+ * takes a few times as long. bound must be at least 1, which leaves nothing
+ * but literals. */
+ssize_t lzjwm_ctx_compress_bounded(lzjwm_ctx_t *ctx, const char *in, size_t isize, char *out, int level,
+                                   const struct lzjwm_params *params, unsigned bound);
+ssize_t lzjwm_compress_bounded(const char *in, size_t isize, char *out, int level,
+                               const struct lzjwm_params *params, unsigned bound);
+
+/* compress in independent blocks of block_size bytes using nthreads threads,
+ * nthreads <= 0 uses one per cpu. matches never reach back past the start of a
+ * block so each one can be decoded on its own, the blocks are simply
+ * concatenated so the output is still one ordinary stream.
+ *
+ * index, if not NULL, is filled in with the start of every block and must have
+ * room for (isize + block_size - 1) / block_size entries.
+ * out must be as big as in, returns a negative number on error */
+ssize_t lzjwm_compress_parallel(const char *in, size_t isize, int nthreads, size_t block_size, int level, char *out, struct lzjwm_offset *index);
+
+/* what decoding all of in costs the recursive decoder in tiny_lzjwm.c, which
+ * has to decode copies of copies again. total is how many compressed bytes
+ * it reads, max the most it reads for any single byte, including the byte,
+ * and depth how many calls deep it recurses below the first. params may be
+ * NULL for the default format. returns -1 if the format isn't supported or
+ * the data refers back past its start. */
+struct lzjwm_work {
+        size_t total, max, depth;
+};
+int lzjwm_decode_work(const char *in, size_t isize, const struct lzjwm_params *params, struct lzjwm_work *work);
+
+/* the same but also calls each(user, coff, uoff, len, cost) for every byte,
+ * in order, with its offset in the compressed and uncompressed data, how many
+ * characters it decodes to and how many bytes decoding it reads. */
+int lzjwm_decode_work_each(const char *in, size_t isize, const struct lzjwm_params *params, struct lzjwm_work *work,
+                           void (*each)(void *user, size_t coff, size_t uoff, size_t len, size_t cost), void *user);
+
+/* try every one of LZJWM_FORMATS on in at the given level, nthreads at a time,
+ * nthreads <= 0 uses one per cpu. results must have room for LZJWM_NFORMATS
+ * entries, in the order they are listed. seconds is the cpu time compressing
+ * took and size is -1 if it failed. returns the index of the format with the
+ * smallest output, the one with the least decode work on a tie, or -1 if
+ * they all failed. */
+#define LZJWM_COUNT_FORMAT(cb, zb) + 1
+#define LZJWM_NFORMATS (0 LZJWM_FORMATS(LZJWM_COUNT_FORMAT))
+
+struct lzjwm_tune {
+        struct lzjwm_params params;
+        ssize_t size;
+        double seconds;
+        struct lzjwm_work work;
+};
+int lzjwm_tune(const char *in, size_t isize, int level, int nthreads, struct lzjwm_tune *results);
+
+/* a record is len characters of output starting at compressed offset coff,
+ * as the recursive decoder is called on it. */
+struct lzjwm_record {
+        size_t coff, len;
+};
+
+/* compress records one after another so that each can be decoded on its own
+ * straight from the compressed data, the start of a record is never pulled
+ * into a copy. offsets, if not NULL, must have room for n entries and is
+ * filled in with where each record starts in the output and its length, an
+ * empty record with no terminator gets offset 0. with LZJWM_TERMINATE a null
+ * is put after every record, with LZJWM_KEEP_NUL a null is never copied so it
+ * can be searched for in the compressed data. bound is as for
+ * lzjwm_compress_bounded, 0 for none. out must be as big as all the records
+ * and their terminators, returns a negative number on error. */
+#define LZJWM_TERMINATE 1
+#define LZJWM_KEEP_NUL 2
+
+struct lzjwm_input {
+        const char *data;
+        size_t len;
+};
+ssize_t lzjwm_ctx_compress_records(lzjwm_ctx_t *ctx, const struct lzjwm_input *records, size_t n, char *out,
+                                   struct lzjwm_record *offsets, int level, int flags,
+                                   const struct lzjwm_params *params, unsigned bound);
+ssize_t lzjwm_compress_records(const struct lzjwm_input *records, size_t n, char *out, struct lzjwm_record *offsets,
+                               int level, int flags, const struct lzjwm_params *params, unsigned bound);
+
+/* add records to the end of blob, records compressed before with the same
+ * flags and params, so they can copy from its tail. blob is copied to the
+ * start of out, which may be blob itself, and the records written after it
+ * so everything already in it keeps its offset. out must have room for blob
+ * as well as the records, offsets gets where each new record starts in out.
+ * returns the size of the whole or a negative number on error. */
+ssize_t lzjwm_ctx_append_records(lzjwm_ctx_t *ctx, const char *blob, size_t bsize, const struct lzjwm_input *records,
+                                 size_t n, char *out, struct lzjwm_record *offsets, int level, int flags,
+                                 const struct lzjwm_params *params, unsigned bound);
+ssize_t lzjwm_append_records(const char *blob, size_t bsize, const struct lzjwm_input *records, size_t n, char *out,
+                             struct lzjwm_record *offsets, int level, int flags, const struct lzjwm_params *params,
+                             unsigned bound);
+
+/* compress with a dictionary, compressed data made by lzjwm_train_dict or any
+ * other compressor, which is treated as if it came just before in. copies may
+ * reach back into it but it is not written to out, so out only needs to be as
+ * big as in. only the last lookback bytes of dict can be reached.
+ * lzjwm_decompress_with_dict undoes it, writing only what in decodes to and
+ * returning its length or -1 if the format isn't supported. */
+ssize_t lzjwm_ctx_compress_with_dict(lzjwm_ctx_t *ctx, const char *dict, size_t dsize, const char *in, size_t isize,
+                                     char *out, int level, const struct lzjwm_params *params);
+ssize_t lzjwm_compress_with_dict(const char *dict, size_t dsize, const char *in, size_t isize, char *out, int level,
+                                 const struct lzjwm_params *params);
+ssize_t lzjwm_decompress_with_dict(const char *dict, size_t dsize, const char *in, size_t isize, char *out,
+                                   const struct lzjwm_params *params);
+
+/* a dictionary made ready for decompressing many messages with, so what it
+ * decodes to is worked out once rather than for every message as
+ * lzjwm_decompress_with_dict does. lzjwm_dict_new returns NULL if the format
+ * isn't supported or out of memory. lzjwm_dict_decompress writes what in
+ * decodes to to out and returns its length. */
+typedef struct lzjwm_dict lzjwm_dict_t;
+lzjwm_dict_t *lzjwm_dict_new(const char *dict, size_t dsize, const struct lzjwm_params *params);
+void lzjwm_dict_free(lzjwm_dict_t *dict);
+ssize_t lzjwm_dict_decompress(const lzjwm_dict_t *dict, const char *in, size_t isize, char *out);
+
+/* build a dictionary for lzjwm_compress_with_dict from n sample messages,
+ * picking the strings that save the most across them. dict must have room for
+ * LZJWM_LOOKBACK(count_bits, zero_bits) bytes, returns the size of the
+ * dictionary or -1 on error. */
+ssize_t lzjwm_train_dict(const struct lzjwm_input *samples, size_t n, char *dict, int level,
+                         const struct lzjwm_params *params);
+
+/* how many compressed bytes the recursive decoder in tiny_lzjwm.c reads
+ * decoding each of records, and how many calls deep it goes below the first.
+ * work must have room for nrecords entries. returns -1 if the format isn't
+ * supported or any record refers back past the start of the data or runs
+ * past the end of it. */
+struct lzjwm_record_work {
+        size_t touched, depth;
+};
+int lzjwm_analyze(const char *in, size_t isize, const struct lzjwm_params *params,
+                  const struct lzjwm_record *records, size_t nrecords, struct lzjwm_record_work *work);
+
+/* recompress data already compressed with params, trying again and again
+ * to find a smaller parse. it is first parsed again at every level, then
+ * over and over with one of the copies in the smallest stream so far ruled
+ * out, keeping the result if it is no bigger and decodes to the same. it
+ * stops after LZJWM_OPTIMIZE_ROUNDS rounds in a row without getting smaller,
+ * or once seconds have gone by if that is above 0. out must be as big as in,
+ * the result is never bigger than it was. stats may be NULL, otherwise it
+ * gets how the search went. returns the size or -1 if in is not valid
+ * compressed data. */
+#define LZJWM_OPTIMIZE_ROUNDS 256
+
+struct lzjwm_optimize_stats {
+        size_t rounds, improved;
+        double seconds;
+        /* stopped because nothing more was found rather than out of time */
+        bool converged;
+};
+ssize_t lzjwm_optimize(const char *in, size_t isize, char *out, const struct lzjwm_params *params, double seconds,
+                       struct lzjwm_optimize_stats *stats);
+
 /* dump representation of encoded stream for debugging */
 void lzjwm_dump(char *in, size_t isize);
 
+#ifdef __cplusplus
+}
+
+namespace lzjwm_detail {
+template <typename Sink>
+size_t decompress_stream(const char *in, size_t isize, bool nul, int cb, int zb, Sink &sink, size_t iptr,
+                         size_t howmany)
+{
+        size_t needed = howmany;
+        while (needed && iptr < isize) {
+                unsigned char ch = in[iptr++];
+                if (!ch && nul)
+                        break;
+                if (!(ch & 0x80)) {
+                        sink((char)ch);
+                        needed--;
+                        continue;
+                }
+                unsigned len, offset;
+                if (zb && (ch | ((1 << (cb + zb)) - 1)) == 0xff) {
+                        len = (ch & ((1 << (cb + zb)) - 1)) + 2;
+                        offset = 0;
+                } else {
+                        len = (ch & ((1 << cb) - 1)) + 2;
+                        offset = ((ch & 0x7f) >> cb) + (zb ? 1 : 0);
+                }
+                if (needed > len)
+                        needed -= decompress_stream(in, isize, nul, cb, zb, sink, iptr - offset - 2, len);
+                else
+                        iptr = iptr - offset - 2;
+        }
+        return howmany - needed;
+}
+}
+
+/* C++ overload of the streaming decoder, sink(c) is called for each decoded
+ * character. since sink is a template parameter it can be any callable and
+ * is inlined rather than called through a pointer. as in C isize may be -1
+ * for null terminated input. */
+template <typename Sink>
+static size_t lzjwm_decompress_stream(const char *in, ssize_t isize, Sink &&sink)
+{
+        return lzjwm_detail::decompress_stream(in, isize, isize == -1, COUNT_BITS, ZERO_BITS, sink, 0, -1);
+}
+
+/* the same for data in any of LZJWM_FORMATS, returns 0 if params isn't. */
+template <typename Sink>
+static size_t lzjwm_decompress_stream_params(const char *in, ssize_t isize, const struct lzjwm_params *params,
+                                             Sink &&sink)
+{
+        if (!lzjwm_params_ok(params))
+                return 0;
+        int cb = params ? params->count_bits : COUNT_BITS, zb = params ? params->zero_bits : ZERO_BITS;
+        return lzjwm_detail::decompress_stream(in, isize, isize == -1, cb, zb, sink, 0, -1);
+}
+#endif
+
 #endif
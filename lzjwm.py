@@ -4,11 +4,19 @@
 # by the C version. but both contain implementations of compression and
 # decompresion.
 
+import copy
 import string
 import sys
 import yaml
 import io
 
+# the C encoder and decoder built by setup.py, which give the same output
+# only a great deal faster. they are used whenever they can be.
+try:
+    import _lzjwm
+except ImportError:
+    _lzjwm = None
+
 
 class Config:
     """ configuration for lzjwm compressor """
@@ -21,9 +29,20 @@ class Config:
         self.max_match = 2**count_bits + 1
         self.max_zero_match = 2**(count_bits + zero_bits) + 1
         self.no_compress = b''
+        # if set, the recursive decoder may never read more than bound bytes
+        # per character to decode any byte in full.
+        self.bound = None
         if zero_bits:
             self.max_offset -= 2**zero_bits
         self.zero_offset = 1 if zero_bits else 0
+        self.zero_mask = (1 << (count_bits + zero_bits)) - 1
+
+    def token(self, ch):
+        """ the offset and count of a copy """
+        if self.zero_bits and (ch | self.zero_mask) == 0xff:
+            return 0, (ch & self.zero_mask) + 2
+        return (((ch & 0x7f) >> self.count_bits) + self.zero_offset,
+                (ch & ((1 << self.count_bits) - 1)) + 2)
 
     def max_match_for_offset(self, offset):
         if offset == 0:
@@ -37,6 +56,8 @@ default_config = Config()
 
 class Node:
     _uninitialized = object()
+    # part of what is being appended to, it can be copied from but not into
+    fixed = False
     def __new__(cls, mv, start=0, aux_data={}, config=default_config):
         if (start >= len(mv)):
             return None
@@ -88,7 +109,7 @@ class Node:
 # return node linked list and modify list of dicts in place with metainfo
 def prepare_nodes(data, config=default_config):
     if isinstance(data, bytes):
-        return Node(memoryview(data))
+        return Node(memoryview(data), config=config)
     ls = []
     offset = 0
     aux_data = {}
@@ -100,15 +121,133 @@ def prepare_nodes(data, config=default_config):
         ls.append(config.terminator)
         offset += len(ls[-1])
         offset += len(ls[-2])
-    return Node(memoryview(b"".join(ls)), aux_data=aux_data)
+    return Node(memoryview(b"".join(ls)), aux_data=aux_data, config=config)
+
+
+def prime(prefix, head, config=default_config):
+    """ put the bytes of prefix that can still be copied from in front of
+    head as nodes of their own, returning the first. """
+    first = max(0, len(prefix) - config.max_offset)
+    counts = [1 if not (ch & 0x80) else config.token(ch)[1] for ch in prefix[first:]]
+    if not head or not counts:
+        return head
+    # each byte can be decoded on its own so only these few need be
+    bio = io.BytesIO()
+    for t, count in enumerate(counts):
+        decompress(prefix, first + t, count, config=config, output=bio)
+    tail = bio.getvalue()
+    mv = memoryview(tail + head.mv.tobytes())
+    nodes = []
+    start = 0
+    for t, count in enumerate(counts):
+        node = Node(mv, start, config=config)
+        # positions carry on back from the head's so distances work out
+        node._start = start - len(tail)
+        node.count = count
+        node.fixed = True
+        node.counter = first + t
+        if nodes:
+            nodes[-1].set_next(node)
+        nodes.append(node)
+        start += count
+    nodes[-1].set_next(head)
+    return nodes[0]
+
+
+def c_compress(s, config, prefix=b''):
+    """ compress with the C encoder, or return None if it can't do it the
+    same way, for input that isn't 7 bit or settings it doesn't have. """
+    terminator = getattr(config, 'terminator', b'')
+    if not _lzjwm or config.no_compress not in (b'', b'\0') or terminator not in (b'', b'\0'):
+        return None
+    if prefix and isinstance(s, bytes):
+        return None
+    kw = {'count_bits': config.count_bits, 'zero_bits': config.zero_bits, 'bound': config.bound or 0,
+          'terminate': bool(terminator), 'keep_nul': bool(config.no_compress)}
+    try:
+        if isinstance(s, bytes) and not config.no_compress:
+            del kw['terminate'], kw['keep_nul']
+            return _lzjwm.compress(s, **kw)
+        if isinstance(s, bytes):
+            # only the record encoder knows not to copy nulls
+            del kw['terminate']
+            return _lzjwm.compress_records([s], **kw)[0]
+        records = [d.get('data', b'') for d in s]
+        if prefix:
+            raw, coffs = _lzjwm.append_records(prefix, records, **kw)
+            raw = raw[len(prefix):]
+        else:
+            raw, coffs = _lzjwm.compress_records(records, **kw)
+    except ValueError:
+        return None
+    # fill in the records as prepare_nodes and _compress would
+    offset = 0
+    for d, coff in zip(s, coffs):
+        d['offset'] = offset
+        d.setdefault('length', len(d.setdefault('data', b'')))
+        # an empty record with no terminator has no byte of its own
+        if d['data'] or terminator:
+            d['compressed_offset'] = coff
+        offset += len(d['data']) + len(terminator)
+    return raw
+
+
+def compress(s, output=sys.stdout.buffer, config=default_config, prefix=b''):
+    """ compress s, bytes or a list of records, to output. with a prefix
+    the output carries on from it, only what comes after is written but
+    the compressed offsets of records count from its start. """
+    raw = c_compress(s, config, prefix)
+    if raw is not None:
+        output.write(raw)
+        return
+    if not config.bound:
+        return _compress(s, output, config, prefix=prefix)
+    # a copy that costs too much is first made to come from somewhere else,
+    # if it still does it isn't made at all. every time round something is
+    # ruled out for good so this stops, at worst with only literals. what
+    # the prefix costs is already settled.
+    forbid = set()
+    avoid = {}
+    skip = decompressed_size(prefix, config)
+    while True:
+        bio = io.BytesIO()
+        _compress(s, bio, config, forbid, avoid, prefix)
+        raw = bio.getvalue()
+        over = False
+        starts = {}
+        for coff, uoff, length, cost in decode_work(prefix + raw, config):
+            starts[coff] = uoff
+            if uoff < skip or cost <= config.bound * length:
+                continue
+            over = True
+            if uoff - skip in avoid:
+                forbid.add(uoff - skip)
+            else:
+                offset, _ = config.token((prefix + raw)[coff])
+                avoid[uoff - skip] = uoff - starts[coff - offset - 1]
+        if not over:
+            output.write(raw)
+            return
+
+
+def append(blob, data, output=sys.stdout.buffer, config=default_config):
+    """ compress records after blob, records compressed before with the same
+    config, so they may copy from its tail but leave it as it is. only the
+    new bytes are written, the offsets of the records count from the start
+    of blob as if they had been compressed along with what is in it. """
+    compress(data, output, config, prefix=blob)
+    skip = decompressed_size(blob, config)
+    for d in data:
+        d['offset'] += skip
 
 
-def compress(s, output=sys.stdout.buffer, config=default_config):
+def _compress(s, output, config, forbid=(), avoid={}, prefix=b''):
     # we start by lazily creating a linked list of all characters in
     # the input string along with the string that comes after it.
     # we utilize a memoryview to not duplicate the bytes in memory.
 
-    head = dptr = prepare_nodes(s, config=config)
+    head = prepare_nodes(s, config=config)
+    dptr = prime(prefix, head, config)
 #    head.dump()
 
     while(dptr):
@@ -121,6 +260,8 @@ def compress(s, output=sys.stdout.buffer, config=default_config):
             if not cl:
                 break
             m = dptr.match(cl, offset)
+            if cl.fixed or cl._start in forbid or avoid.get(cl._start) == cl._start - dptr._start:
+                m = 0
             if (m >= 2):  # if we match at least 2 bytes, try to add match
                 nn = cl
                 j = d = 0
@@ -146,8 +287,8 @@ def compress(s, output=sys.stdout.buffer, config=default_config):
                     cl.count = j     # j may be less than m if it would have broken an existing match
                     cl.offset = dptr
         dptr = dptr.next
-    zero_offset = config.zero_bits
-    counter = 0
+    zero_mask = (1 << (config.count_bits + config.zero_bits)) - 1
+    counter = len(prefix)
     # walk the final list outputting characters or matches as we encounter
     # them.
 #    head.dump()
@@ -155,9 +296,13 @@ def compress(s, output=sys.stdout.buffer, config=default_config):
         if(head.aux_data):
             head.aux_data['compressed_offset'] = counter
         if head.count > 1:
-            assert head.count <= config.max_match
-            the_byte = 0x80 | ((counter - head.offset.counter - 1) <<
-                               config.count_bits) | ((head.count - 2) & (2**config.count_bits - 1))
+            offset = counter - head.offset.counter - 1
+            assert head.count <= config.max_match_for_offset(offset)
+            if config.zero_bits and offset == 0:
+                the_byte = (0xff & ~zero_mask) | (head.count - 2)
+            else:
+                the_byte = 0x80 | ((offset - config.zero_offset) <<
+                                   config.count_bits) | ((head.count - 2) & (2**config.count_bits - 1))
             output.write(bytes([the_byte]))
         else:
             output.write(bytes([head.data[0]]))
@@ -166,10 +311,215 @@ def compress(s, output=sys.stdout.buffer, config=default_config):
         head = head.next
 
 
+class AhoCorasick:
+    """ finds every occurrence of any of a set of byte strings in a text in a
+    single pass. the trie is kept in flat lists with the transitions in one
+    dict keyed by node * 256 + byte, an object per node would be far too
+    heavy for big string tables. node 0 is the root. """
+
+    def __init__(self, patterns):
+        self.goto = {}
+        # the pattern that ends at each node or -1
+        self.out = [-1]
+        parent = [0]
+        byte = [0]
+        depth = [0]
+        for n, p in enumerate(patterns):
+            node = 0
+            for c in p:
+                k = node * 256 + c
+                if k not in self.goto:
+                    self.goto[k] = len(self.out)
+                    self.out.append(-1)
+                    parent.append(node)
+                    byte.append(c)
+                    depth.append(depth[node] + 1)
+                node = self.goto[k]
+            self.out[node] = n
+        # fail is the node for the longest proper suffix of each node that is
+        # in the trie, link the nearest along those that ends a pattern.
+        self.fail = [0] * len(self.out)
+        self.link = [0] * len(self.out)
+        for node in sorted(range(1, len(self.out)), key=depth.__getitem__):
+            if parent[node]:
+                f = self.fail[node] = self.step(self.fail[parent[node]], byte[node])
+                self.link[node] = f if self.out[f] >= 0 else self.link[f]
+
+    def step(self, node, c):
+        while node and node * 256 + c not in self.goto:
+            node = self.fail[node]
+        return self.goto.get(node * 256 + c, 0)
+
+    def find(self, text):
+        """ yield where each match ends in text and which pattern it is """
+        node = 0
+        for i, c in enumerate(text):
+            node = self.step(node, c)
+            m = node if self.out[node] >= 0 else self.link[node]
+            while m:
+                yield i + 1, self.out[m]
+                m = self.link[m]
+
+
+def find_contained(data, suffix_only=False):
+    """ for each record, None or the index of another record it can be decoded
+    out of and where in it it starts. a record is only ever found inside one
+    that isn't inside any other itself, and of identical records the first
+    holds the others. with suffix_only it has to end where the other does. """
+    owner = {}
+    for i, d in enumerate(data):
+        owner.setdefault(d['data'], i)
+    patterns = [p for p in owner if p]
+    index = {p: n for n, p in enumerate(patterns)}
+    ac = AhoCorasick(patterns)
+    # for each pattern found in a longer one, the first one and where in it
+    inside = {}
+    for t, text in enumerate(patterns):
+        for end, q in ac.find(text):
+            if q != t and q not in inside and (not suffix_only or end == len(text)):
+                inside[q] = (t, end - len(patterns[q]))
+    result = []
+    for i, d in enumerate(data):
+        if not d['data']:
+            result.append(None)
+            continue
+        # being inside carries over, and the one it is in is always longer
+        n = index[d['data']]
+        pos = 0
+        while n in inside:
+            n, a = inside[n]
+            pos += a
+        host = owner[patterns[n]]
+        result.append((host, pos) if host != i else None)
+    return result
+
+
+# an overlap shorter than this saves no more than the compressor would have
+# from leaving records that start alike together.
+MIN_OVERLAP = 4
+
+
+def overlap_chains(strings, overlap=True):
+    """ order strings, none of which may be inside another, so that they
+    share as much as possible. this is the greedy shortest common
+    superstring heuristic: the pair with the longest overlap between the end
+    of one and the start of the other is joined first, then the next longest
+    and so on, with the overlaps found by hashing the ends of every string at
+    each length in turn. the chains that come out are sorted so ones that
+    start alike end up together.
+
+    returns a list of chains, each the string it makes and a list of which
+    strings are in it and where. without overlap the strings are only
+    sorted. """
+    n = len(strings)
+    succ = [None] * n
+    pred = [None] * n
+    over = [0] * n
+    # the other end of the chain for the first and last string of each
+    head = list(range(n))
+    tail = list(range(n))
+    lengths = sorted((len(s) for s in strings), reverse=True)
+    # an overlap has to leave some of both strings over
+    longest = lengths[1] - 1 if overlap and n > 1 else 0
+    for k in range(longest, MIN_OVERLAP - 1, -1):
+        ends = {}
+        for i, s in enumerate(strings):
+            if succ[i] is None and len(s) > k:
+                ends.setdefault(s[-k:], []).append(i)
+        if not ends:
+            continue
+        for j, s in enumerate(strings):
+            if pred[j] is not None or len(s) <= k:
+                continue
+            cands = ends.get(s[:k], [])
+            for c, i in enumerate(cands):
+                # joining the end of a chain to its own start makes a loop
+                if i != tail[j]:
+                    break
+            else:
+                continue
+            del cands[c]
+            succ[i], pred[j], over[i] = j, i, k
+            h, t = head[i], tail[j]
+            tail[h], head[t] = t, h
+    chains = []
+    for i in range(n):
+        if pred[i] is not None:
+            continue
+        text = strings[i]
+        members = [(i, 0)]
+        while succ[i] is not None:
+            pos = len(text) - over[i]
+            i = succ[i]
+            members.append((i, pos))
+            text += strings[i][len(text) - pos:]
+        chains.append((text, members))
+    chains.sort(key=lambda c: c[0])
+    return chains
+
+
+def compress_shared(data, output=sys.stdout.buffer, config=default_config, order=False):
+    """ compress records like compress, but a record found inside another is
+    not compressed again. the other one is split so the record starts on a
+    byte of its own, which it is then pointed at. with order the records
+    are also rearranged by overlap_chains, one that starts with the end of
+    another is placed over it. a terminator has to stay at the end of each
+    record so then they are only sorted. """
+    terminator = getattr(config, 'terminator', b'')
+    hosts = find_contained(data, suffix_only=bool(terminator))
+    tops = [i for i, h in enumerate(hosts) if not h]
+    if order:
+        chains = overlap_chains([data[i]['data'] for i in tops], overlap=not terminator)
+    else:
+        chains = [(data[i]['data'], [(t, 0)]) for t, i in enumerate(tops)]
+    # which string each record goes out in and where it starts in it
+    place = {}
+    for c, (_, members) in enumerate(chains):
+        for t, pos in members:
+            place[tops[t]] = (c, pos)
+    for i, h in enumerate(hosts):
+        if h:
+            c, pos = place[h[0]]
+            place[i] = (c, pos + h[1])
+    cuts = {}
+    for c, pos in place.values():
+        cuts.setdefault(c, set()).add(pos)
+    # the strings go out in pieces, one for every place a record starts in
+    # them. the pieces are records of their own to the compressor so each
+    # starts a new byte.
+    pieces = []
+    starts = {}
+    for c, (s, _) in enumerate(chains):
+        cs = sorted(cuts[c] | {0})
+        for a, b in zip(cs, cs[1:] + [len(s)]):
+            starts[c, a] = {'data': s[a:b]}
+            pieces.append(starts[c, a])
+        pieces[-1]['data'] += terminator
+    plain = copy.copy(config)
+    plain.terminator = b''
+    compress(pieces, output, plain)
+    for i, d in enumerate(data):
+        p = starts[place[i]]
+        d['offset'] = p['offset']
+        d.setdefault('length', len(d['data']))
+        if 'compressed_offset' in p:
+            d['compressed_offset'] = p['compressed_offset']
+
+
+def decompressed_size(s, config=default_config):
+    return sum(1 if not (ch & 0x80) else config.token(ch)[1] for ch in s)
+
+
 def decompress(s, start=0, howmany=(1 << 64), config=default_config, output=sys.stdout.buffer):
+    if _lzjwm and start == 0 and howmany == 1 << 64:
+        try:
+            data = _lzjwm.decompress(s, count_bits=config.count_bits, zero_bits=config.zero_bits)
+            output.write(data)
+            return len(data)
+        except ValueError:
+            pass
     needed = howmany
     slen = len(s)
-    count_bits = config.count_bits
     while (needed and start < slen):
         ch = s[start]
         start += 1
@@ -177,14 +527,43 @@ def decompress(s, start=0, howmany=(1 << 64), config=default_config, output=sys.
             output.write(bytes([ch]))
             needed -= 1
         else:
-            offset = (ch & 0x7f) >> count_bits
-            count = (ch & ((1 << count_bits) - 1)) + 2
+            offset, count = config.token(ch)
             if (needed > count):
-                needed -= decompress(s, start - offset - 2, count, output=output)
+                needed -= decompress(s, start - offset - 2, count, config=config, output=output)
             else:
                 start = start - offset - 2
     return howmany - needed
 
+def decode_work(s, config=default_config):
+    """ yield the compressed and uncompressed offset, length and how many
+    bytes the recursive decoder reads to decode it for every byte of s, like
+    lzjwm_decode_work_each in the C version. """
+    # costs[t][n] is what it takes to get the first n + 1 characters out of t
+    costs = {}
+    uoff = 0
+    for t, ch in enumerate(s):
+        if not (ch & 0x80):
+            cost = [1]
+        else:
+            offset, count = config.token(ch)
+            # the walk can come back round to t itself for the last few
+            cost = costs[t] = []
+            c = 1
+            k = t - offset - 1
+            while len(cost) < count:
+                kc = costs[k]
+                kl = 1 if not (s[k] & 0x80) else config.token(s[k])[1]
+                done = len(cost)
+                for n in range(min(count - done, kl)):
+                    cost.append(c + kc[n])
+                c += kc[kl - 1]
+                k += 1
+        costs[t] = cost
+        costs.pop(t - 128, None)
+        yield t, uoff, len(cost), cost[-1]
+        uoff += len(cost)
+
+
 # simple utility to help output code.
 class CodeWriter:
     def __init__(self, linelength=80, output=sys.stdout):
@@ -252,9 +631,12 @@ class CodeWriter:
 
 
 def main(args):
-
+    global _lzjwm
+    if args.pure:
+        _lzjwm = None
     if args.z:
         default_config.no_compress = b"\0"
+    default_config.bound = args.B
     default_config.terminator = b"\0" if args.__dict__['0'] else b""
     bs = []
     for file in args.file:
@@ -273,6 +655,9 @@ def main(args):
         s = b"".join(ls)
         decompress(s, output=args.o)
     if args.c:
+        table = {'raw': b'', 'parts': []}
+        if args.A:
+            table = yaml.load(args.A, Loader=getattr(yaml, 'CSafeLoader', yaml.SafeLoader))
         if args.y:
             data = []
             for _, s in bs:
@@ -283,7 +668,7 @@ def main(args):
                         d['data'] = d['data'].encode("ascii")
         elif args.l:
             lines = (b"".join([y for _, y in bs])).splitlines()
-            data = [{'data': s, 'name': i} for i, s in enumerate(lines)]
+            data = [{'data': s, 'name': i} for i, s in enumerate(lines, len(table['parts']))]
         else:
             data = [{'name': fn, 'data': s} for fn, s in bs]
 
@@ -295,9 +680,17 @@ def main(args):
             for k, vs in sorted(sdict.items()):
                 data.append({'data': k, 'vs': vs})
 
+        squeeze = compress
+        if args.S or args.O:
+            def squeeze(data, output):
+                compress_shared(data, output, order=args.O)
+        if args.A:
+            def squeeze(data, output):
+                output.write(table['raw'])
+                append(table['raw'], data, output)
         if args.f != 'raw':
             bio = io.BytesIO()
-            compress(data, output=bio)
+            squeeze(data, output=bio)
             fdata = []
             for x in data:
                 del x['data']
@@ -311,10 +704,13 @@ def main(args):
                     fdata += x['vs']
                 else:
                     fdata.append(x)
-            data = fdata
+            data = table['parts'] + fdata
             raw = bio.getvalue()
             if args.f == 'yaml':
-                args.o.write(yaml.dump({ 'raw': raw , 'compressed_length': len(raw), 'parts': data}, indent=4).encode("ascii"))
+                # libyaml writes the same only much faster than pure python
+                dumper = getattr(yaml, 'CDumper', yaml.Dumper)
+                args.o.write(yaml.dump({ 'raw': raw , 'compressed_length': len(raw), 'parts': data}, indent=4,
+                                       Dumper=dumper).encode("ascii"))
             if args.f in ('c', 'c_avr') :
                 tio = io.StringIO()
                 c = CodeWriter(output=tio)
@@ -337,7 +733,7 @@ def main(args):
                 args.o.write(tio.getvalue().encode("ascii"))
 
         else:
-            compress(data, output=args.o)
+            squeeze(data, output=args.o)
 
 
 if __name__ == "__main__":
@@ -355,12 +751,22 @@ if __name__ == "__main__":
     parser.add_argument('-0', action='store_true',
                         help='append a null terminator to each thing compressed.')
 
+    parser.add_argument('-B', type=int,
+                        help='never let the decoder read more than this many bytes per character to decode any byte')
     parser.add_argument('--verbose', '-v', action='count', default=0)
+    parser.add_argument('--pure', action='store_true',
+                        help='use only the python code even if the C module is built')
 
     parser.add_argument('-l', action='store_true',
                         help='treat each line in input as its own record')
     parser.add_argument('-s', action='store_true',
                         help='attempt to rearange and unify records for better compression')
+    parser.add_argument('-S', action='store_true',
+                        help='point records found inside another record into it rather than compressing them again')
+    parser.add_argument('-O', action='store_true',
+                        help='also reorder records so ones that overlap go together, implies -S')
+    parser.add_argument('-A', type=argparse.FileType('rb'),
+                        help='append the records to a table written with -f yaml, leaving those in it where they are')
     parser.add_argument('-f', help='output format when compressing',
                         choices=('raw', 'c', 'yaml', 'c_avr'), default='raw')
     parser.add_argument('file', nargs='*',
@@ -372,6 +778,9 @@ if __name__ == "__main__":
         print("one of -c or -d is required")
         parser.print_help(sys.stderr)
         sys.exit(1)
+    if args.A and (args.s or args.S or args.O):
+        print("-A can't be used with -s, -S or -O")
+        sys.exit(1)
     main(args)
 
 
@@ -0,0 +1,377 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <err.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+/* benchmark every implementation over a set of files.
+ *
+ * usage: lzjwm_bench [-n iterations] [-t seconds] [-p] [-o json] files...
+ *
+ * -n minimum number of calls to time for each implementation and file
+ * -t keep going until this many seconds have been spent on each, default 0.2
+ * -p also time the python encoder. one python3 per file imports lzjwm.py and
+ *    times compress() over and over itself, so interpreter startup is not
+ *    counted. python_compress is the pure python code and python_compress_c
+ *    uses the _lzjwm module when it is built.
+ * -o write the results as JSON to this file as well as printing a table
+ */
+
+/* the tiny decoder is meant to be pasted into other code, so we do just that.
+ * it prints with putchar and shares its names with the library so rename
+ * both out of the way. */
+#define TINY_LZJWM_NO_MAIN
+#define lzjwm_decompress tiny_lzjwm_decompress
+static unsigned long tiny_sink;
+static void hash(unsigned long *h, const char *buf, size_t len)
+{
+        for (size_t i = 0; i < len; i++)
+                *h = *h * 31 + (unsigned char)buf[i];
+}
+
+static void tiny_put(char c)
+{
+        hash(&tiny_sink, &c, 1);
+}
+#define putchar(c) tiny_put(c)
+#include "tiny_lzjwm.c"
+#undef putchar
+#undef lzjwm_decompress
+#undef COUNT_BITS
+#undef ZERO_BITS
+#undef ZERO_MASK
+#undef COUNT
+#undef OFFSET
+
+#include "resizable_buf.h"
+#include "lzjwm.h"
+
+#define nitems(x)       (sizeof((x)) / sizeof((x)[0]))
+
+struct input {
+        const char *name;
+        char *data, *compressed, *out;
+        size_t size, csize;
+        /* the hash of the data and what tiny_sink should come to, the tiny
+         * decoder stops at a null */
+        unsigned long check, tiny_check;
+};
+
+struct result;
+
+/* an implementation runs once over the input, it returns false if the result
+ * was wrong. one that times itself fills in the result instead. */
+struct impl {
+        const char *name;
+        bool (*run)(struct input *in);
+        bool (*time)(struct input *in, size_t min_calls, double min_time, struct result *r);
+};
+
+static bool run_compress(struct input *in)
+{
+        return lzjwm_compress(in->data, in->size, in->out) == in->csize && !memcmp(in->out, in->compressed, in->csize);
+}
+
+static bool run_decompress(struct input *in)
+{
+        return lzjwm_decompress(in->compressed, in->csize, in->out) == in->size && !memcmp(in->out, in->data, in->size);
+}
+
+static bool run_decompress_fast(struct input *in)
+{
+        return lzjwm_decompress_fast(in->compressed, in->csize, in->out) == in->size
+               && !memcmp(in->out, in->data, in->size);
+}
+
+/* the decoders that hand their output to a callback hash it into here */
+static unsigned long sink;
+
+static int hash_putc(int c, void *user)
+{
+        char ch = c;
+        hash(&sink, &ch, 1);
+        return c;
+}
+
+static void hash_write(void *user, const char *buf, size_t len)
+{
+        hash(&sink, buf, len);
+}
+
+static bool run_stream(struct input *in)
+{
+        sink = 0;
+        return lzjwm_decompress_stream(in->compressed, in->csize, hash_putc, NULL) == in->size && sink == in->check;
+}
+
+static bool run_stream_buf(struct input *in)
+{
+        char buf[4096];
+        sink = 0;
+        return lzjwm_decompress_stream_buf(in->compressed, in->csize, buf, sizeof(buf), hash_write, NULL) == in->size
+               && sink == in->check;
+}
+
+static bool run_ring(struct input *in)
+{
+        sink = 0;
+        return lzjwm_decompress_ring(in->compressed, in->csize, hash_write, NULL) == in->size && sink == in->check;
+}
+
+/* the compressed data has a trailing null for this one */
+static bool run_tiny(struct input *in)
+{
+        tiny_sink = 0;
+        tiny_lzjwm_decompress(in->compressed, 0, -1);
+        return tiny_sink == in->tiny_check;
+}
+
+struct result {
+        const char *file, *impl;
+        size_t size, csize, calls;
+        double mbps, ns_per_byte, p50, p99;
+        bool ok;
+};
+
+static double now(void)
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int cmp_double(const void *x, const void *y)
+{
+        double a = *(const double *)x, b = *(const double *)y;
+        return (a > b) - (a < b);
+}
+
+/* fill in r from the time of each of its calls */
+static void summarize(struct result *r, rb_t *times)
+{
+        double total = 0;
+        r->calls = RB_NITEMS(double, times);
+        for (size_t i = 0; i < r->calls; i++)
+                total += RBP(double, times)[i];
+        if (!r->calls)
+                return;
+        qsort(rb_ptr(times), r->calls, sizeof(double), cmp_double);
+        r->p50 = RBP(double, times)[r->calls / 2];
+        r->p99 = RBP(double, times)[(r->calls * 99) / 100];
+        r->mbps = total ? r->calls * (double)r->size / total / 1e6 : 0;
+        r->ns_per_byte = r->size ? total * 1e9 / (r->calls * (double)r->size) : 0;
+}
+
+/* lzjwm.py is timed from inside python, this prints the time of each call
+ * and then whether the last result decompresses back to the input. */
+static const char python_script[] =
+        "import io, sys, time\n"
+        "sys.path.insert(0, '.')\n"
+        "import lzjwm\n"
+        "name, pure, calls, min_time = sys.argv[1], sys.argv[2] == '1', int(sys.argv[3]), float(sys.argv[4])\n"
+        "if pure:\n"
+        "    lzjwm._lzjwm = None\n"
+        "data = open(name, 'rb').read()\n"
+        "n = total = 0\n"
+        "while n < calls or total < min_time:\n"
+        "    out = io.BytesIO()\n"
+        "    start = time.perf_counter()\n"
+        "    lzjwm.compress(data, out)\n"
+        "    t = time.perf_counter() - start\n"
+        "    print(t)\n"
+        "    n += 1\n"
+        "    total += t\n"
+        "back = io.BytesIO()\n"
+        "lzjwm.decompress(out.getvalue(), output=back)\n"
+        "print('ok' if back.getvalue() == data else 'bad')\n";
+
+static bool python(struct input *in, bool pure, size_t min_calls, double min_time, struct result *r)
+{
+        int fds[2];
+        if (pipe(fds) < 0)
+                return false;
+        pid_t pid = fork();
+        if (pid < 0)
+                return false;
+        if (!pid) {
+                char calls[32], secs[32];
+                snprintf(calls, sizeof(calls), "%zu", min_calls);
+                snprintf(secs, sizeof(secs), "%g", min_time);
+                dup2(fds[1], 1);
+                close(fds[0]);
+                close(fds[1]);
+                execlp("python3", "python3", "-c", python_script, in->name, pure ? "1" : "0", calls, secs,
+                       (char *)NULL);
+                _exit(127);
+        }
+        close(fds[1]);
+        FILE *fh = fdopen(fds[0], "r");
+        rb_t times = RB_BLANK;
+        char line[64];
+        bool ok = false;
+        while (fh && fgets(line, sizeof(line), fh)) {
+                if (!strcmp(line, "ok\n"))
+                        ok = true;
+                else
+                        RB_PUSH(double, &times) = atof(line);
+        }
+        if (fh)
+                fclose(fh);
+        else
+                close(fds[0]);
+        int status;
+        waitpid(pid, &status, 0);
+        summarize(r, &times);
+        rb_free(&times);
+        return ok && WIFEXITED(status) && !WEXITSTATUS(status);
+}
+
+static bool time_python(struct input *in, size_t min_calls, double min_time, struct result *r)
+{
+        return python(in, true, min_calls, min_time, r);
+}
+
+/* lzjwm.py with the _lzjwm module, if it has been built */
+static bool time_python_c(struct input *in, size_t min_calls, double min_time, struct result *r)
+{
+        return python(in, false, min_calls, min_time, r);
+}
+
+static struct result bench(struct input *in, const struct impl *impl, size_t min_calls, double min_time)
+{
+        struct result r = { .file = in->name, .impl = impl->name, .size = in->size, .csize = in->csize, .ok = true };
+        if (impl->time) {
+                r.ok = impl->time(in, min_calls, min_time, &r);
+                return r;
+        }
+        rb_t times = RB_BLANK;
+        double total = 0;
+        size_t calls = 0;
+        while (calls < min_calls || total < min_time) {
+                double start = now();
+                r.ok &= impl->run(in);
+                double t = now() - start;
+                RB_PUSH(double, &times) = t;
+                total += t;
+                calls++;
+        }
+        summarize(&r, &times);
+        rb_free(&times);
+        return r;
+}
+
+static void print_json(FILE *fh, const struct result *rs, size_t n)
+{
+        fprintf(fh, "[\n");
+        for (size_t i = 0; i < n; i++) {
+                const struct result *r = &rs[i];
+                fprintf(fh, "  {\"file\": \"%s\", \"impl\": \"%s\", \"size\": %zu, \"compressed_size\": %zu, "
+                        "\"ratio\": %.4f, \"calls\": %zu, \"mb_per_s\": %.2f, \"ns_per_byte\": %.3f, ",
+                        r->file, r->impl, r->size, r->csize, r->size ? (double)r->csize / r->size : 1.0,
+                        r->calls, r->mbps, r->ns_per_byte);
+                if (r->calls > 1)
+                        fprintf(fh, "\"p50_us\": %.2f, \"p99_us\": %.2f, ", r->p50 * 1e6, r->p99 * 1e6);
+                else
+                        fprintf(fh, "\"p50_us\": null, \"p99_us\": null, ");
+                fprintf(fh, "\"ok\": %s}%s\n", r->ok ? "true" : "false", i + 1 < n ? "," : "");
+        }
+        fprintf(fh, "]\n");
+}
+
+static const struct impl impls[] = {
+        { "compress", run_compress },
+        { "decompress", run_decompress },
+        { "decompress_fast", run_decompress_fast },
+        { "decompress_stream", run_stream },
+        { "decompress_stream_buf", run_stream_buf },
+        { "decompress_ring", run_ring },
+        { "tiny_lzjwm", run_tiny },
+        { "python_compress", .time = time_python },
+        { "python_compress_c", .time = time_python_c },
+};
+
+int main(int argc, char *argv[])
+{
+        size_t min_calls = 5;
+        double min_time = 0.2;
+        bool python = false;
+        char *json = NULL;
+        int opt;
+        while ((opt = getopt(argc, argv, "n:t:po:")) != -1) {
+                switch (opt) {
+                case 'n':
+                        min_calls = strtoul(optarg, NULL, 0);
+                        break;
+                case 't':
+                        min_time = atof(optarg);
+                        break;
+                case 'p':
+                        python = true;
+                        break;
+                case 'o':
+                        json = optarg;
+                        break;
+                default:
+                        fprintf(stderr, "usage: lzjwm_bench [-n iterations] [-t seconds] [-p] [-o json] files...\n");
+                        exit(1);
+                }
+        }
+        rb_t results = RB_BLANK;
+        bool all_ok = true;
+        printf("%-16s %-22s %9s %7s %9s %8s %10s %10s\n",
+               "file", "impl", "size", "ratio", "MB/s", "ns/byte", "p50 us", "p99 us");
+        for (int i = optind; i < argc; i++) {
+                struct stat st;
+                if (stat(argv[i], &st) || !S_ISREG(st.st_mode))
+                        continue;
+                rb_t rb = RB_BLANK;
+                if (rb_read_file(&rb, argv[i]) < 0)
+                        exit(1);
+                struct input in = { .name = argv[i], .data = rb_ptr(&rb), .size = rb_len(&rb) };
+                in.out = malloc(in.size + LZJWM_SLACK);
+                in.compressed = malloc(in.size + 1);
+                ssize_t csize = lzjwm_compress(in.data, in.size, in.compressed);
+                if (csize < 0) {
+                        warnx("%s: can't compress", argv[i]);
+                        continue;
+                }
+                in.csize = csize;
+                in.compressed[in.csize] = '\0';
+                tiny_sink = 0;
+                for (size_t k = 0; k < in.size && in.data[k]; k++)
+                        tiny_put(in.data[k]);
+                in.tiny_check = tiny_sink;
+                hash(&in.check, in.data, in.size);
+                for (int j = 0; j < nitems(impls); j++) {
+                        if (impls[j].time && !python)
+                                continue;
+                        struct result r = bench(&in, &impls[j], min_calls, min_time);
+                        all_ok &= r.ok;
+                        /* a single call has no spread worth showing */
+                        char p50[32] = "-", p99[32] = "-";
+                        if (r.calls > 1) {
+                                snprintf(p50, sizeof(p50), "%.2f", r.p50 * 1e6);
+                                snprintf(p99, sizeof(p99), "%.2f", r.p99 * 1e6);
+                        }
+                        printf("%-16s %-22s %9zu %7.4f %9.2f %8.3f %10s %10s%s\n",
+                               strrchr(r.file, '/') ? strrchr(r.file, '/') + 1 : r.file, r.impl, r.size,
+                               r.size ? (double)r.csize / r.size : 1.0, r.mbps, r.ns_per_byte,
+                               p50, p99, r.ok ? "" : " FAILED");
+                        RB_LPUSH(&results, r);
+                }
+                free(in.out);
+                free(in.compressed);
+        }
+        if (json) {
+                FILE *fh = fopen(json, "w");
+                if (!fh)
+                        err(1, "%s", json);
+                print_json(fh, rb_ptr(&results), RB_NITEMS(struct result, &results));
+                fclose(fh);
+        }
+        return all_ok ? 0 : 1;
+}
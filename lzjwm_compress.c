@@ -1,90 +1,1115 @@
 /* simple encoder in C, the python lzjwm.py is more featureful. */
 
+#ifndef NDEBUG
+#define NDEBUG
+#endif
+
 #include "lzjwm.h"
+#include <stddef.h>
 #include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
 #include <assert.h>
+#include <time.h>
 
-#define NDEBUG
+/* candidates are indexed by their first two characters. only a match of 2 or
+ * more is useful so a node whose key differs from the current position can
+ * never be matched and need not be visited at all. */
+#define NKEYS (1 << 14)
+#define KEY(c0, c1) (((uint8_t)(c0) << 7) | (uint8_t)(c1))
+
+#define KILL(l, i) ((l)[(i) >> 6] &= ~(1ULL << ((i) & 63)))
+#define REVIVE(l, i) ((l)[(i) >> 6] |= (1ULL << ((i) & 63)))
+#define IS_SET(l, i) ((l)[(i) >> 6] & (1ULL << ((i) & 63)))
+
+/* how many positions past the current one the first search level plays the
+ * greedy algorithm forward to judge each alternative, each level above that
+ * doubles it. */
+#define SEARCH_HORIZON 16
+#define MAX_HORIZON (SEARCH_HORIZON << (LZJWM_LEVEL_MAX - 1))
+
+/* everything is kept in rings indexed by absolute input position. a node can
+ * only be matched by one at most LOOKBACK nodes before it, so only a short
+ * window around the current position is ever looked at. */
+#define R(st, p) ((p) & (st)->mask)
+#define IN(st, p) ((st)->in[R(st, p)])
+#define CNT(st, p) ((st)->count[R(st, p)])
+
+#define OBUF 4096
+
+#define ALWAYS_INLINE inline __attribute__((always_inline))
 
-static char mk_ptr(uint8_t count, uint8_t offset)
+/* the default format must be one of the ones instantiated below */
+#define IS_DEFAULT(cb, zb) || ((cb) == COUNT_BITS && (zb) == ZERO_BITS)
+_Static_assert(0 LZJWM_FORMATS(IS_DEFAULT), "COUNT_BITS and ZERO_BITS must be in LZJWM_FORMATS");
+
+/* a saved copy of a node so speculative changes can be rolled back. */
+struct undo {
+        int64_t k;
+        uint16_t from;
+        uint8_t count;
+        bool killed;
+};
+
+struct lzjwm_cstream {
+        /* fed is how much input has been seen, dptr is the next node to
+         * process and optr how much output has been written. */
+        int64_t fed, dptr, optr;
+        int horizon;
+        bool error;
+        /* the copy of the compressor for the format in use */
+        void (*advance)(struct lzjwm_cstream *st, int64_t upto);
+        /* how much input we need past dptr before processing it and how much
+         * before it must be kept around. */
+        int64_t lookahead, behind;
+        int64_t mask;
+        /* the rings are allocated big enough for any level */
+        int64_t size;
+        bool owned;
+        /* the nodes are kept as separate arrays of the narrowest type that
+         * will do rather than as structs. a node covers count characters of
+         * input starting at its position, the next node always starts right
+         * after it. from is how far back the node that matched it is, which
+         * is within the window, and once it is written out from holds the
+         * low bits of its output offset instead, which is all a pointer to it
+         * needs. */
+        char *in;
+        uint8_t *count;
+        uint16_t *from;
+        /* chain links each live node to the next one with the same key and
+         * chain_prev back to the one before, live has a bit set for every node
+         * still in the list. */
+        int64_t *chain, *chain_prev;
+        uint64_t *live;
+        /* step walks every node rather than the chain */
+        bool dense;
+        /* when journaling, every change made is recorded here */
+        bool journal;
+        struct undo *log;
+        int nlog;
+        void (*write)(void *user, const char *buf, size_t len);
+        void *user;
+        int olen;
+        char obuf[OBUF];
+        /* restrictions on which copies may be made, if any. positions in
+         * them count from base, the start of the input. */
+        const struct limits *limits;
+        int64_t base;
+        /* last is the newest node for each key. it is never cleared, an
+         * entry only counts if it is a node of this input, which starts at
+         * first, that has the key, see newest. */
+        int64_t first;
+        int64_t last[NKEYS];
+};
+
+struct limits {
+        /* a bit for each record start, these are never pulled into a copy
+         * so they can be decoded from directly */
+        const uint64_t *barrier;
+        /* a bit for each position that may not be turned into a copy, and
+         * how far back a copy at each may not come from */
+        uint64_t *forbid;
+        uint16_t *avoid;
+        /* never copy a null so it stays in the compressed data as is */
+        bool keep_nul;
+        /* compressed data the input carries on from, and all of it
+         * decompressed. it goes before base and is never changed. */
+        const char *prefix, *text;
+        size_t psize, tsize;
+};
+
+/* a node is at most LZJWM_MAX_ZERO_MATCH long so this covers the lookback
+ * nodes every step looks at, for each of the horizon nodes a rollout steps
+ * through. */
+#define LOOKAHEAD(horizon, cb, zb) \
+        (((horizon) + LZJWM_LOOKBACK(cb, zb) + 2) * LZJWM_MAX_ZERO_MATCH(cb, zb) + 2)
+#define BEHIND(cb, zb) ((LZJWM_LOOKBACK(cb, zb) + 1) * LZJWM_MAX_ZERO_MATCH(cb, zb))
+#define WINDOW(horizon, cb, zb) \
+        (LOOKAHEAD(horizon, cb, zb) + BEHIND(cb, zb) + LZJWM_MAX_ZERO_MATCH(cb, zb))
+
+/* the size of this is the largest window of any format, the rings are made
+ * big enough for every level and format. */
+union max_window {
+#define MAX_WINDOW(cb, zb) char f_##cb##_##zb[WINDOW(MAX_HORIZON, cb, zb)];
+        LZJWM_FORMATS(MAX_WINDOW)
+};
+
+static int64_t ring_size(int64_t window)
+{
+        int64_t size = 64;
+        while (size < window)
+                size *= 2;
+        return size;
+}
+
+static int64_t max_ring_size(void)
+{
+        return ring_size(sizeof(union max_window));
+}
+
+/* while searching every node in the ring can be killed once, and each of
+ * the steps through the horizon can add up to LOOKBACK more matches. the
+ * longest lookback of any format is with one count bit. */
+static int log_size(void)
+{
+        return max_ring_size() + LZJWM_LOOKBACK(1, 0) * (MAX_HORIZON + 2);
+}
+
+static ALWAYS_INLINE char mk_ptr(uint8_t count, uint8_t offset, int cb, int zb)
 {
         assert(count >= 2);
         assert(offset >= 0);
-        assert(offset < LOOKBACK);
-        if (ZERO_BITS && offset == 0)
+        assert(offset < LZJWM_LOOKBACK(cb, zb));
+        if (zb && offset == 0)
                 //return 0xf0 | (count - 2);
-                return ~((1 << (COUNT_BITS + ZERO_BITS)) - 1)  | (count - 2);
-        return 0x80 | ((offset - (ZERO_BITS ? 1 : 0)) << COUNT_BITS) | (count - 2);
+                return ~((1 << (cb + zb)) - 1)  | (count - 2);
+        return 0x80 | ((offset - (zb ? 1 : 0)) << cb) | (count - 2);
 }
 
 
 
-static int match(const char *data, int x, int y, int max, int max_match)
+static int match(const struct lzjwm_cstream *st, int64_t x, int64_t y, int max_match)
 {
         assert(x != y);
-        assert(x <= max);
-        assert(y <= max);
+        assert(x <= st->fed);
+        assert(y <= st->fed);
         int result = 0;
-        int mresult = x > y ? max - x : max - y;
+        int64_t mresult = x > y ? st->fed - x : st->fed - y;
         if (mresult > max_match)
                 mresult = max_match;
-        while (result < mresult && data[x + result] == data[y + result])
+        while (result < mresult && IN(st, x + result) == IN(st, y + result))
                 result++;
         return result;
 }
 
+/* count the live nodes strictly between x and y, giving up once limit is
+ * reached since anything that far out is beyond the lookahead anyway. the
+ * ring is a multiple of 64 so words never straddle the wrap. */
+static int live_between(const struct lzjwm_cstream *st, int64_t x, int64_t y, int limit)
+{
+        int n = 0;
+        for (x++; x < y && n < limit; x = (x | 63) + 1) {
+                uint64_t bits = st->live[R(st, x) >> 6] >> (x & 63);
+                if (y - x < 64 - (x & 63))
+                        bits &= (1ULL << (y - x)) - 1;
+                n += __builtin_popcountll(bits);
+        }
+        return n;
+}
+
+/* whether position p is still in the ring */
+static bool held(const struct lzjwm_cstream *st, int64_t p)
+{
+        return p >= 0 && p > st->fed - 1 - (st->mask + 1);
+}
+
+static int key(const struct lzjwm_cstream *st, int64_t p)
+{
+        return KEY(IN(st, p), IN(st, p + 1));
+}
+
+static void save(struct lzjwm_cstream *st, int64_t k, bool killed)
+{
+        assert(st->nlog < log_size());
+        st->log[st->nlog++] = (struct undo) { .k = k, .killed = killed, .from = st->from[R(st, k)], .count = CNT(st, k) };
+}
+
+/* take a node out of the list of candidates, nodes removed from the list are
+ * also unlinked from their chain so they are never visited again. */
+static void kill(struct lzjwm_cstream *st, int64_t k)
+{
+        int64_t p = st->chain_prev[R(st, k)], n = st->chain[R(st, k)];
+        KILL(st->live, R(st, k));
+        if (held(st, p))
+                st->chain[R(st, p)] = n;
+        if (n != -1)
+                st->chain_prev[R(st, n)] = p;
+        else if (k + 1 < st->fed)
+                st->last[key(st, k)] = p;
+}
+
+/* put back a node removed by kill, nodes must be revived in the opposite
+ * order to which they were killed. */
+static void revive(struct lzjwm_cstream *st, int64_t k)
+{
+        int64_t p = st->chain_prev[R(st, k)], n = st->chain[R(st, k)];
+        REVIVE(st->live, R(st, k));
+        if (held(st, p))
+                st->chain[R(st, p)] = k;
+        if (n != -1)
+                st->chain_prev[R(st, n)] = k;
+        else if (k + 1 < st->fed)
+                st->last[key(st, k)] = k;
+}
+
+/* undo everything recorded in the journal past mark */
+static void rollback(struct lzjwm_cstream *st, int mark)
+{
+        while (st->nlog > mark) {
+                struct undo *u = &st->log[--st->nlog];
+                st->from[R(st, u->k)] = u->from;
+                CNT(st, u->k) = u->count;
+                if (u->killed)
+                        revive(st, u->k);
+        }
+}
+
+/* find how many nodes starting at cl can be pulled into a match of m
+ * characters without overshooting it. returns the first node left over and
+ * sets j to the characters and d to the nodes that would be replaced. */
+static int64_t munch(const struct lzjwm_cstream *st, int64_t cl, int m, int *j, int *d)
+{
+        int64_t nn = cl;
+        *d = *j = 0;
+        for (; nn < st->fed; (*d)++) {
+                int c = CNT(st, nn);
+                if (*j + c > m)
+                        break;
+                *j += c;
+                nn += c;
+        }
+        return nn;
+}
+
+/* how much of a match of m characters between dptr and cl the limits allow.
+ * a record start is never copied over, and since it is never copied to
+ * either it is always a node of its own that munch stops right before. */
+static int allowed(const struct lzjwm_cstream *st, int64_t dptr, int64_t cl, int m)
+{
+        const struct limits *l = st->limits;
+        int64_t p = cl - st->base;
+        if (p < 0)
+                return 0;
+        if (l->forbid && (IS_SET(l->forbid, p) || l->avoid[p] == cl - dptr))
+                return 0;
+        for (int k = 0; l->barrier && k < m; k++)
+                if (IS_SET(l->barrier, p + k))
+                        m = k;
+        for (int k = 0; l->keep_nul && k < m; k++)
+                if (!IN(st, dptr + k))
+                        m = k;
+        return m;
+}
+
+/* try to splice a match between dptr and cl, i nodes on, into the list.
+ * found counts the matches that were available, see step for alt. */
+static ALWAYS_INLINE void try_match(struct lzjwm_cstream *st, int64_t dptr, int64_t cl, int i, int alt, int *found,
+                                    int cb, int zb)
+{
+        int max = i ? LZJWM_MAX_MATCH(cb) : LZJWM_MAX_ZERO_MATCH(cb, zb);
+        /* a match has to take in at least two nodes, if the first two are
+         * already too long together there is no point comparing. */
+        int64_t next = cl + CNT(st, cl);
+        if (next >= st->fed || CNT(st, cl) + CNT(st, next) > max)
+                return;
+        int m = match(st, dptr, cl, max);
+        if (st->limits)
+                m = allowed(st, dptr, cl, m);
+        int j, d = 0;
+        int64_t nn = 0;
+        if (m >= 2)
+                nn = munch(st, cl, m, &j, &d);
+        if (d >= 2) {
+                int k = (*found)++;
+                if (alt == k * 2)
+                        d = 0;
+                else if (alt == k * 2 + 1)
+                        nn = munch(st, cl, m - 1, &j, &d);
+        }
+        if (d >= 2) {
+                for (int64_t k = cl + CNT(st, cl); k != nn; k += CNT(st, k)) {
+                        if (st->journal)
+                                save(st, k, true);
+                        kill(st, k);
+                }
+                if (st->journal)
+                        save(st, cl, false);
+                CNT(st, cl) = j;
+                st->from[R(st, cl)] = cl - dptr;
+        }
+}
+
+/* look ahead from dptr and splice every match we find into the list.
+ *
+ * alt picks an alternative to the plain greedy choice for the search levels,
+ * the k'th match that would have been made is passed over when alt is 2k and
+ * is made one character shorter when alt is 2k + 1. pass -1 to be greedy.
+ *
+ * when most of the nodes in reach share dptr's key, as in a run of one
+ * character, following the chain costs more than walking every node, so
+ * step switches to that until the chain thins out again. both visit the same
+ * candidates in the same order so the output is the same either way.
+ *
+ * returns the number of matches that were available. */
+static ALWAYS_INLINE int step(struct lzjwm_cstream *st, int64_t dptr, int alt, int cb, int zb)
+{
+        const int lookback = LZJWM_LOOKBACK(cb, zb);
+        int found = 0, hits = 0;
+        if (st->dense) {
+                int k = key(st, dptr);
+                int64_t cl = dptr + CNT(st, dptr);
+                for (int i = 0; i < lookback && cl + 1 < st->fed; i++) {
+                        if (key(st, cl) == k) {
+                                hits++;
+                                try_match(st, dptr, cl, i, alt, &found, cb, zb);
+                        }
+                        cl += CNT(st, cl);
+                }
+                st->dense = hits * 2 >= lookback;
+                return found;
+        }
+        /* i is the number of links between dptr and cl, which is exactly the
+         * offset the forward walk would have reached it at. */
+        int i = 0;
+        int64_t prev = dptr;
+        for (int64_t cl = st->chain[R(st, dptr)]; cl != -1; cl = st->chain[R(st, cl)]) {
+                i += live_between(st, prev, cl, lookback - i);
+                if (i >= lookback)
+                        break;
+                try_match(st, dptr, cl, i, alt, &found, cb, zb);
+                prev = cl;
+                i++;
+                hits++;
+        }
+        st->dense = hits * 2 >= lookback;
+        return found;
+}
+
+/* play the greedy algorithm forward and see how far into the input the
+ * following nodes reach, the further the better. */
+static ALWAYS_INLINE int64_t rollout(struct lzjwm_cstream *st, int64_t dptr, int horizon,
+                                     int (*step)(struct lzjwm_cstream *, int64_t, int))
+{
+        int64_t last = dptr;
+        for (int n = 0; n < horizon && dptr < st->fed; n++) {
+                step(st, dptr, -1);
+                last = dptr;
+                dptr += CNT(st, dptr);
+        }
+        return dptr >= st->fed ? st->fed + horizon : last;
+}
+
+/* at a position with matches available, try each alternative to the greedy
+ * choice, and keep whichever one covers the most input after playing the
+ * greedy algorithm forward horizon positions. */
+static ALWAYS_INLINE void search(struct lzjwm_cstream *st, int64_t dptr, int horizon,
+                                 int (*step)(struct lzjwm_cstream *, int64_t, int))
+{
+        int found = step(st, dptr, -1);
+        if (!found) {
+                st->nlog = 0;
+                return;
+        }
+        int best = -1;
+        int64_t reach = rollout(st, dptr + CNT(st, dptr), horizon, step);
+        rollback(st, 0);
+        for (int alt = 0; alt < found * 2; alt++) {
+                step(st, dptr, alt);
+                int64_t r = rollout(st, dptr + CNT(st, dptr), horizon, step);
+                rollback(st, 0);
+                if (r > reach) {
+                        reach = r;
+                        best = alt;
+                }
+        }
+        step(st, dptr, best);
+        st->nlog = 0;
+}
+
+static void flush(struct lzjwm_cstream *st)
+{
+        if (st->olen)
+                st->write(st->user, st->obuf, st->olen);
+        st->olen = 0;
+}
+
+/* write out dptr, it can no longer change once we have moved past it */
+static ALWAYS_INLINE void emit(struct lzjwm_cstream *st, int64_t dptr, int cb, int zb)
+{
+        uint16_t *from = &st->from[R(st, dptr)];
+        if (CNT(st, dptr) < 2)
+                st->obuf[st->olen++] = IN(st, dptr) & 0x7f;
+        else {
+                uint16_t src = st->from[R(st, dptr - *from)];
+                st->obuf[st->olen++] = mk_ptr(CNT(st, dptr), (uint16_t)(st->optr - src - 1), cb, zb);
+        }
+        *from = st->optr++;
+        if (st->olen == OBUF)
+                flush(st);
+}
+
+/* process every node before upto */
+static ALWAYS_INLINE void advance(struct lzjwm_cstream *st, int64_t upto,
+                                  int (*step)(struct lzjwm_cstream *, int64_t, int), int cb, int zb)
+{
+        while (st->dptr < upto) {
+                if (st->horizon)
+                        search(st, st->dptr, st->horizon, step);
+                else
+                        step(st, st->dptr, -1);
+                /* a prefix is only there to be copied from */
+                if (st->dptr >= st->base)
+                        emit(st, st->dptr, cb, zb);
+                st->dptr += CNT(st, st->dptr);
+        }
+}
+
+/* a copy of step and advance for each format so the shifts and limits are
+ * all constants. */
+#define INSTANCE(cb, zb) \
+static int step_##cb##_##zb(struct lzjwm_cstream *st, int64_t dptr, int alt) \
+{ \
+        return step(st, dptr, alt, cb, zb); \
+} \
+static void advance_##cb##_##zb(struct lzjwm_cstream *st, int64_t upto) \
+{ \
+        advance(st, upto, step_##cb##_##zb, cb, zb); \
+}
+LZJWM_FORMATS(INSTANCE)
+
+static const struct format {
+        int cb, zb;
+        void (*advance)(struct lzjwm_cstream *st, int64_t upto);
+} formats[] = {
+#define FORMAT(cb, zb) { cb, zb, advance_##cb##_##zb },
+        LZJWM_FORMATS(FORMAT)
+};
+
+static const struct format *find_format(const struct lzjwm_params *params)
+{
+        int cb = params ? params->count_bits : COUNT_BITS;
+        int zb = params ? params->zero_bits : ZERO_BITS;
+        for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++)
+                if (formats[i].cb == cb && formats[i].zb == zb)
+                        return &formats[i];
+        return NULL;
+}
+
+bool lzjwm_params_ok(const struct lzjwm_params *params)
+{
+        return find_format(params);
+}
+
+/* the newest node with key k before p. every node with that key from the
+ * one before first, which put links when first is fed, up to p has set
+ * last[k], so if last[k] isn't one of them it is left over from before and
+ * there is none. */
+static int64_t newest(const struct lzjwm_cstream *st, int k, int64_t p)
+{
+        int64_t t = st->last[k];
+        return t >= st->first - 1 && t < p && held(st, t) && key(st, t) == k ? t : -1;
+}
+
+/* add a character to the end of the list, the one before it now has both
+ * characters of its key and can be chained. */
+static void put(struct lzjwm_cstream *st, char c)
+{
+        int64_t q = st->fed++;
+        st->in[R(st, q)] = c;
+        CNT(st, q) = 1;
+        st->chain[R(st, q)] = st->chain_prev[R(st, q)] = -1;
+        REVIVE(st->live, R(st, q));
+        if (!q)
+                return;
+        int k = key(st, q - 1);
+        int64_t t = newest(st, k, q - 1);
+        if (t != -1)
+                st->chain[R(st, t)] = q - 1;
+        st->chain_prev[R(st, q - 1)] = t;
+        st->last[k] = q - 1;
+}
+
+size_t lzjwm_ctx_size(void)
+{
+        int64_t size = max_ring_size();
+        return sizeof(struct lzjwm_cstream) + log_size() * sizeof(struct undo)
+               + size * (2 * sizeof(int64_t) + sizeof(uint16_t) + 2) + size / 8;
+}
+
+lzjwm_ctx_t *lzjwm_ctx_new(void *mem, size_t msize)
+{
+        struct lzjwm_cstream *st = mem;
+        if (!st)
+                st = malloc(lzjwm_ctx_size());
+        else if (msize < lzjwm_ctx_size() || (uintptr_t)mem % sizeof(int64_t))
+                return NULL;
+        if (!st)
+                return NULL;
+        /* last doesn't need clearing, which would cost more than compressing
+         * a short input */
+        memset(st, 0, offsetof(struct lzjwm_cstream, last));
+        st->owned = !mem;
+        st->size = max_ring_size();
+        /* from must be able to reach back across the window */
+        assert(st->size <= 1 << 16);
+        char *p = (char *)(st + 1);
+        st->chain = (int64_t *)p;
+        p += st->size * sizeof(int64_t);
+        st->chain_prev = (int64_t *)p;
+        p += st->size * sizeof(int64_t);
+        st->log = (struct undo *)p;
+        p += log_size() * sizeof(struct undo);
+        st->live = (uint64_t *)p;
+        p += st->size / 8;
+        st->from = (uint16_t *)p;
+        p += st->size * sizeof(uint16_t);
+        st->in = p;
+        p += st->size;
+        st->count = (uint8_t *)p;
+        return st;
+}
+
+void lzjwm_ctx_free(lzjwm_ctx_t *st)
+{
+        if (st && st->owned)
+                free(st);
+}
+
+/* get ready for a new input. positions carry on from the last one and skip
+ * a whole ring ahead so nothing left over from it is still considered to be
+ * in the ring. returns false if the format isn't supported. */
+static bool start(struct lzjwm_cstream *st, int level, const struct lzjwm_params *params,
+                  void (*write)(void *user, const char *buf, size_t len), void *user)
+{
+        const struct format *f = find_format(params);
+        if (!f)
+                return false;
+        if (level > LZJWM_LEVEL_MAX)
+                level = LZJWM_LEVEL_MAX;
+        st->advance = f->advance;
+        st->horizon = level > LZJWM_LEVEL_FAST ? SEARCH_HORIZON << (level - 1) : 0;
+        st->journal = st->horizon;
+        st->lookahead = LOOKAHEAD(st->horizon, f->cb, f->zb);
+        st->behind = BEHIND(f->cb, f->zb);
+        st->mask = ring_size(WINDOW(st->horizon, f->cb, f->zb)) - 1;
+        st->fed = st->dptr = st->fed + st->size;
+        st->base = st->first = st->fed;
+        st->limits = NULL;
+        st->optr = 0;
+        st->error = false;
+        st->nlog = st->olen = 0;
+        st->write = write;
+        st->user = user;
+        return true;
+}
+
+/* write out whatever is left, returns the compressed size */
+static ssize_t end(struct lzjwm_cstream *st)
+{
+        if (st->error)
+                return -1;
+        st->advance(st, st->fed);
+        flush(st);
+        return st->optr;
+}
+
+struct lzjwm_cstream *lzjwm_cstream_init_params(int level, const struct lzjwm_params *params,
+                                                void (*write)(void *user, const char *buf, size_t len), void *user)
+{
+        struct lzjwm_cstream *st = lzjwm_ctx_new(NULL, 0);
+        if (st && !start(st, level, params, write, user)) {
+                lzjwm_ctx_free(st);
+                return NULL;
+        }
+        return st;
+}
+
+struct lzjwm_cstream *lzjwm_cstream_init(int level, void (*write)(void *user, const char *buf, size_t len), void *user)
+{
+        return lzjwm_cstream_init_params(level, NULL, write, user);
+}
+
+int lzjwm_cstream_feed(struct lzjwm_cstream *st, const char *in, size_t len)
+{
+        if (st->error)
+                return -1;
+        while (len) {
+                /* never overwrite anything a node yet to be written out may
+                 * still refer back to */
+                size_t n = st->dptr - st->behind + st->mask + 1 - st->fed;
+                if (n > len)
+                        n = len;
+                for (size_t i = 0; i < n; i++) {
+                        if (in[i] & 0x80) {
+                                st->error = true;
+                                return -1;
+                        }
+                        put(st, in[i]);
+                }
+                in += n;
+                len -= n;
+                st->advance(st, st->fed - st->lookahead);
+        }
+        return 0;
+}
+
+ssize_t lzjwm_cstream_finish(struct lzjwm_cstream *st)
+{
+        ssize_t res = end(st);
+        lzjwm_ctx_free(st);
+        return res;
+}
+
+static void write_out(void *user, const char *buf, size_t len)
+{
+        char **out = user;
+        memcpy(*out, buf, len);
+        *out += len;
+}
+
+static void discard(void *user, const char *buf, size_t len)
+{
+}
+
+/* how many characters a compressed byte stands for */
+static int token_len(uint8_t c, int cb, int zb)
+{
+        int zmask = (1 << (cb + zb)) - 1;
+        if (!(c & 0x80))
+                return 1;
+        if (zb && (c | zmask) == 0xff)
+                return (c & zmask) + 2;
+        return (c & ((1 << cb) - 1)) + 2;
+}
+
+/* put the end of the prefix in the ring as the nodes it was written out as,
+ * only its last LOOKBACK bytes can be copied from. the input goes after it
+ * and is written out as if following straight on from it. */
+static void prime(struct lzjwm_cstream *st, const struct limits *l, int cb, int zb)
+{
+        size_t lookback = LZJWM_LOOKBACK(cb, zb), first = l->psize > lookback ? l->psize - lookback : 0, len = 0;
+        for (size_t t = first; t < l->psize; t++)
+                len += token_len(l->prefix[t], cb, zb);
+        const char *p = l->text + l->tsize - len;
+        for (size_t t = first; t < l->psize; t++) {
+                int64_t q = st->fed;
+                int c = token_len(l->prefix[t], cb, zb);
+                for (int k = 0; k < c; k++)
+                        put(st, *p++);
+                for (int k = 1; k < c; k++)
+                        kill(st, q + k);
+                CNT(st, q) = c;
+                st->from[R(st, q)] = t;
+        }
+        st->base = st->fed;
+        st->optr = l->psize;
+}
+
+static ssize_t compress(lzjwm_ctx_t *ctx, const char *in, size_t isize, char *out, int level,
+                       const struct lzjwm_params *params, const struct limits *limits)
+{
+        if (!start(ctx, level, params, out ? write_out : discard, &out))
+                return -1;
+        ctx->limits = limits;
+        size_t psize = limits ? limits->psize : 0;
+        if (psize)
+                prime(ctx, limits, params ? params->count_bits : COUNT_BITS, params ? params->zero_bits : ZERO_BITS);
+        lzjwm_cstream_feed(ctx, in, isize);
+        ssize_t res = end(ctx);
+        return res < 0 ? res : res - (ssize_t)psize;
+}
+
+static ssize_t compress_best(lzjwm_ctx_t *ctx, const char *in, size_t isize, char *out, int level,
+                             const struct lzjwm_params *params, const struct limits *limits)
+{
+        ssize_t res = compress(ctx, in, isize, out, level, params, limits);
+        if (res < 0 || level <= LZJWM_LEVEL_FAST)
+                return res;
+        /* the lookahead is only a heuristic so make sure we never do worse
+         * than plain greedy. the greedy size is found first without keeping
+         * the output so no second buffer is needed. */
+        if (compress(ctx, in, isize, NULL, LZJWM_LEVEL_FAST, params, limits) < res)
+                res = compress(ctx, in, isize, out, LZJWM_LEVEL_FAST, params, limits);
+        return res;
+}
+
+ssize_t lzjwm_ctx_compress_params(lzjwm_ctx_t *ctx, const char *in, size_t isize, char *out, int level,
+                                  const struct lzjwm_params *params)
+{
+        return compress_best(ctx, in, isize, out, level, params, NULL);
+}
+
+struct bound {
+        struct limits *limits;
+        unsigned bound;
+        int cb, zb;
+        size_t over, skip;
+        const char *out;
+        /* where the output of each of the last few bytes starts */
+        size_t starts[128];
+};
+
+/* how many bytes back past the one before it a copy comes from */
+static int copy_offset(uint8_t c, int cb, int zb)
+{
+        int zmask = (1 << (cb + zb)) - 1;
+        return zb && (c | zmask) == 0xff ? 0 : ((c & 0x7f) >> cb) + (zb ? 1 : 0);
+}
+
+/* a copy that costs too much is first made to come from somewhere else, if
+ * it still costs too much it is ruled out altogether. */
+static void check_bound(void *user, size_t coff, size_t uoff, size_t len, size_t cost)
+{
+        struct bound *b = user;
+        b->starts[coff & 127] = uoff;
+        if (uoff < b->skip || cost <= (size_t)b->bound * len)
+                return;
+        int off = copy_offset(b->out[coff], b->cb, b->zb);
+        size_t dist = uoff - b->starts[(coff - off - 1) & 127];
+        uoff -= b->skip;
+        if (b->limits->avoid[uoff])
+                REVIVE(b->limits->forbid, uoff);
+        else
+                b->limits->avoid[uoff] = dist;
+        b->over++;
+}
+
+/* compress within limits, and if bound is set keep going until decoding no
+ * byte costs more than bound per character. with a prefix out has to follow
+ * it so the whole can be decoded, what the prefix itself costs is its own
+ * business. */
+static ssize_t compress_limited(lzjwm_ctx_t *ctx, const char *in, size_t isize, char *out, int level,
+                                const struct lzjwm_params *params, struct limits *limits, unsigned bound)
+{
+        if (!bound)
+                return compress_best(ctx, in, isize, out, level, params, limits);
+        struct bound b = { .limits = limits, .bound = bound, .out = out - limits->psize, .skip = limits->tsize };
+        b.cb = params ? params->count_bits : COUNT_BITS;
+        b.zb = params ? params->zero_bits : ZERO_BITS;
+        limits->forbid = calloc(isize / 64 + 1, sizeof(uint64_t));
+        limits->avoid = calloc(isize + 1, sizeof(uint16_t));
+        ssize_t res = -1;
+        /* every time round something is ruled out for good so this has to
+         * stop, at worst with nothing but literals. */
+        while (limits->forbid && limits->avoid) {
+                struct lzjwm_work work;
+                res = compress(ctx, in, isize, out, level, params, limits);
+                b.over = 0;
+                if (res >= 0 && lzjwm_decode_work_each(b.out, limits->psize + res, params, &work, check_bound, &b) < 0)
+                        res = -1;
+                if (res < 0 || !b.over)
+                        break;
+        }
+        free(limits->forbid);
+        free(limits->avoid);
+        limits->forbid = NULL;
+        limits->avoid = NULL;
+        return res;
+}
+
+ssize_t lzjwm_ctx_compress_bounded(lzjwm_ctx_t *ctx, const char *in, size_t isize, char *out, int level,
+                                   const struct lzjwm_params *params, unsigned bound)
+{
+        struct limits limits = { 0 };
+        if (!bound || !lzjwm_params_ok(params))
+                return -1;
+        return compress_limited(ctx, in, isize, out, level, params, &limits, bound);
+}
+
+struct locate {
+        const struct lzjwm_input *records;
+        size_t n, i, start, nul;
+        struct lzjwm_record *offsets;
+};
+
+/* every record but an empty one without a terminator starts on a byte of
+ * its own, those are left at offset 0. */
+static void locate(void *user, size_t coff, size_t uoff, size_t len, size_t cost)
+{
+        struct locate *l = user;
+        for (; l->i < l->n && l->start <= uoff; l->i++) {
+                size_t rlen = l->records[l->i].len;
+                if (l->start == uoff && (rlen || l->nul))
+                        l->offsets[l->i].coff = coff;
+                l->start += rlen + l->nul;
+        }
+}
+
+/* compress records after blob, which is copied to the start of out once
+ * nothing can go wrong but running out of memory, returns the size of the
+ * whole. */
+static ssize_t records_after(lzjwm_ctx_t *ctx, const char *blob, size_t psize, const struct lzjwm_input *records,
+                             size_t n, char *out, struct lzjwm_record *offsets, int level, int flags,
+                             const struct lzjwm_params *params, unsigned bound)
+{
+        size_t nul = flags & LZJWM_TERMINATE ? 1 : 0, isize = 0;
+        for (size_t i = 0; i < n; i++)
+                isize += records[i].len + nul;
+        if (!lzjwm_params_ok(params))
+                return -1;
+        struct limits limits = { .keep_nul = flags & LZJWM_KEEP_NUL, .prefix = out, .psize = psize };
+        limits.tsize = lzjwm_decompressed_size_params(blob, psize, params);
+        char *in = malloc(isize + 1), *text = malloc(limits.tsize + 1);
+        uint64_t *barrier = calloc(isize / 64 + 1, sizeof(uint64_t));
+        limits.barrier = barrier;
+        limits.text = text;
+        ssize_t res = -1;
+        size_t p = 0;
+        for (size_t i = 0; in && barrier && i < n; i++) {
+                REVIVE(barrier, p);
+                for (size_t j = 0; j < records[i].len; j++)
+                        if (records[i].data[j] & 0x80)
+                                goto done;
+                memcpy(in + p, records[i].data, records[i].len);
+                p += records[i].len;
+                if (nul)
+                        in[p++] = '\0';
+        }
+        if (in && text && barrier) {
+                lzjwm_decompress_params(blob, psize, text, params);
+                memmove(out, blob, psize);
+                res = compress_limited(ctx, in, isize, out + psize, level, params, &limits, bound);
+        }
+        if (res >= 0)
+                res += psize;
+        if (res >= 0 && offsets) {
+                struct locate l = { .records = records, .n = n, .start = limits.tsize, .nul = nul, .offsets = offsets };
+                struct lzjwm_work work;
+                for (size_t i = 0; i < n; i++)
+                        offsets[i] = (struct lzjwm_record) { 0, records[i].len };
+                if (lzjwm_decode_work_each(out, res, params, &work, locate, &l) < 0)
+                        res = -1;
+        }
+done:
+        free(in);
+        free(text);
+        free(barrier);
+        return res;
+}
+
+ssize_t lzjwm_ctx_compress_records(lzjwm_ctx_t *ctx, const struct lzjwm_input *records, size_t n, char *out,
+                                   struct lzjwm_record *offsets, int level, int flags,
+                                   const struct lzjwm_params *params, unsigned bound)
+{
+        return records_after(ctx, out, 0, records, n, out, offsets, level, flags, params, bound);
+}
+
+ssize_t lzjwm_ctx_append_records(lzjwm_ctx_t *ctx, const char *blob, size_t bsize, const struct lzjwm_input *records,
+                                 size_t n, char *out, struct lzjwm_record *offsets, int level, int flags,
+                                 const struct lzjwm_params *params, unsigned bound)
+{
+        return records_after(ctx, blob, bsize, records, n, out, offsets, level, flags, params, bound);
+}
+
+ssize_t lzjwm_ctx_compress_with_dict(lzjwm_ctx_t *ctx, const char *dict, size_t dsize, const char *in, size_t isize,
+                                     char *out, int level, const struct lzjwm_params *params)
+{
+        if (!lzjwm_params_ok(params))
+                return -1;
+        struct limits limits = { .prefix = dict, .psize = dsize };
+        limits.tsize = lzjwm_decompressed_size_params(dict, dsize, params);
+        char *text = malloc(limits.tsize + 1);
+        if (!text)
+                return -1;
+        lzjwm_decompress_params(dict, dsize, text, params);
+        limits.text = text;
+        ssize_t res = compress_best(ctx, in, isize, out, level, params, &limits);
+        free(text);
+        return res;
+}
+
+ssize_t lzjwm_ctx_compress(lzjwm_ctx_t *ctx, const char *in, size_t isize, char *out, int level)
+{
+        return lzjwm_ctx_compress_params(ctx, in, isize, out, level, NULL);
+}
+
 /* out must be at lesat as big as in. */
 ssize_t lzjwm_compress(const char *in, size_t isize, char *out)
 {
-        struct {
-                int next, from;
-                uint8_t count;
-        } *as;
-        as = malloc(isize * sizeof(*as));
-        for (int i = 0; i < isize; i++) {
-                if (in[i] & 0x80) {
-                        free(as);
-                        return -1;
+        return lzjwm_compress_level(in, isize, out, LZJWM_LEVEL_FAST);
+}
+
+ssize_t lzjwm_compress_params(const char *in, size_t isize, char *out, int level, const struct lzjwm_params *params)
+{
+        lzjwm_ctx_t *ctx = lzjwm_ctx_new(NULL, 0);
+        if (!ctx)
+                return -1;
+        ssize_t res = lzjwm_ctx_compress_params(ctx, in, isize, out, level, params);
+        lzjwm_ctx_free(ctx);
+        return res;
+}
+
+ssize_t lzjwm_compress_bounded(const char *in, size_t isize, char *out, int level,
+                               const struct lzjwm_params *params, unsigned bound)
+{
+        lzjwm_ctx_t *ctx = lzjwm_ctx_new(NULL, 0);
+        if (!ctx)
+                return -1;
+        ssize_t res = lzjwm_ctx_compress_bounded(ctx, in, isize, out, level, params, bound);
+        lzjwm_ctx_free(ctx);
+        return res;
+}
+
+ssize_t lzjwm_compress_records(const struct lzjwm_input *records, size_t n, char *out, struct lzjwm_record *offsets,
+                               int level, int flags, const struct lzjwm_params *params, unsigned bound)
+{
+        lzjwm_ctx_t *ctx = lzjwm_ctx_new(NULL, 0);
+        if (!ctx)
+                return -1;
+        ssize_t res = lzjwm_ctx_compress_records(ctx, records, n, out, offsets, level, flags, params, bound);
+        lzjwm_ctx_free(ctx);
+        return res;
+}
+
+ssize_t lzjwm_append_records(const char *blob, size_t bsize, const struct lzjwm_input *records, size_t n, char *out,
+                             struct lzjwm_record *offsets, int level, int flags, const struct lzjwm_params *params,
+                             unsigned bound)
+{
+        lzjwm_ctx_t *ctx = lzjwm_ctx_new(NULL, 0);
+        if (!ctx)
+                return -1;
+        ssize_t res = lzjwm_ctx_append_records(ctx, blob, bsize, records, n, out, offsets, level, flags, params, bound);
+        lzjwm_ctx_free(ctx);
+        return res;
+}
+
+ssize_t lzjwm_compress_with_dict(const char *dict, size_t dsize, const char *in, size_t isize, char *out, int level,
+                                 const struct lzjwm_params *params)
+{
+        lzjwm_ctx_t *ctx = lzjwm_ctx_new(NULL, 0);
+        if (!ctx)
+                return -1;
+        ssize_t res = lzjwm_ctx_compress_with_dict(ctx, dict, dsize, in, isize, out, level, params);
+        lzjwm_ctx_free(ctx);
+        return res;
+}
+
+ssize_t lzjwm_compress_level(const char *in, size_t isize, char *out, int level)
+{
+        return lzjwm_compress_params(in, isize, out, level, NULL);
+}
+
+/* the copies in a stream, as where each starts in the uncompressed data and
+ * how far back it copies from. */
+struct hints {
+        const char *in;
+        int cb, zb;
+        size_t n;
+        struct hint {
+                size_t uoff;
+                uint16_t dist;
+        } *h;
+        size_t starts[128];
+};
+
+static void collect_hint(void *user, size_t coff, size_t uoff, size_t len, size_t cost)
+{
+        struct hints *h = user;
+        h->starts[coff & 127] = uoff;
+        if (len < 2)
+                return;
+        int off = copy_offset(h->in[coff], h->cb, h->zb);
+        h->h[h->n++] = (struct hint) { uoff, uoff - h->starts[(coff - off - 1) & 127] };
+}
+
+/* whether c is a stream that decodes to text, checked before decoding it
+ * so a bad one can't read outside of c. */
+static bool verify(const char *c, size_t csize, const char *text, size_t tsize, char *buf,
+                   const struct lzjwm_params *params)
+{
+        struct lzjwm_work work;
+        return lzjwm_decode_work(c, csize, params, &work) >= 0
+               && lzjwm_decompressed_size_params(c, csize, params) == tsize
+               && lzjwm_decompress_params(c, csize, buf, params) == tsize && !memcmp(buf, text, tsize);
+}
+
+static double now(void)
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+ssize_t lzjwm_optimize(const char *in, size_t isize, char *out, const struct lzjwm_params *params, double seconds,
+                       struct lzjwm_optimize_stats *stats)
+{
+        struct lzjwm_work work;
+        if (!lzjwm_params_ok(params) || lzjwm_decode_work(in, isize, params, &work) < 0)
+                return -1;
+        double start = now();
+        size_t tsize = lzjwm_decompressed_size_params(in, isize, params);
+        char *text = malloc(tsize + 1), *buf = malloc(tsize + 1), *cand = malloc(tsize + 1);
+        struct limits limits = { .forbid = calloc(tsize / 64 + 1, sizeof(uint64_t)),
+                                 .avoid = calloc(tsize + 1, sizeof(uint16_t)) };
+        struct hints h = { .cb = params ? params->count_bits : COUNT_BITS, .zb = params ? params->zero_bits : ZERO_BITS };
+        h.h = malloc((tsize + 1) * sizeof(*h.h));
+        lzjwm_ctx_t *ctx = lzjwm_ctx_new(NULL, 0);
+        ssize_t best = -1;
+        struct lzjwm_optimize_stats st = { 0 };
+        if (!text || !buf || !cand || !limits.forbid || !limits.avoid || !h.h || !ctx)
+                goto done;
+        lzjwm_decompress_params(in, isize, text, params);
+        memmove(out, in, isize);
+        best = isize;
+
+        /* first the data is parsed again at every level, then at the level
+         * that did best one copy at a time in the best stream so far is ruled
+         * out, or made to stay a literal, so the parse has to find its way
+         * round it, which changes what is in reach of everything after. a
+         * stream that comes out the same size is kept too so the search
+         * moves on from there. it stops once nothing smaller has turned up
+         * for a while. */
+        uint64_t seed = 0x9e3779b97f4a7c15ULL;
+        size_t stale = 0;
+        bool fresh = true;
+        int at = LZJWM_LEVEL_MAX;
+        for (size_t round = 0;; round++) {
+                if (fresh) {
+                        h.in = out;
+                        h.n = 0;
+                        lzjwm_decode_work_each(out, best, params, &work, collect_hint, &h);
+                        fresh = false;
+                }
+                bool sweep = round <= LZJWM_LEVEL_MAX;
+                if (!sweep && !h.n) {
+                        st.converged = true;
+                        break;
                 }
-                as[i].next = i + 1;
-                as[i].count = 1;
-                as[i].from = 0;
-        }
-        as[isize - 1].next = -1;
-        for (int dptr = 0; dptr != -1; dptr = as[dptr].next) {
-                int cl = dptr;
-                for (int i = 0; i < LOOKBACK; i++) {
-                        cl = as[cl].next;
-                        if (cl < 0)
-                                break;
-                        int m = match(in, dptr, cl, isize, i ? MAX_MATCH : MAX_ZERO_MATCH);
-                        if (m >= 2) {
-                                int nn = cl;
-                                int d = 0, j = 0;
-                                for (; nn != -1; d++) {
-                                        int c = as[nn].count;
-                                        if (j + c > m)
-                                                break;
-                                        j += c;
-                                        nn = as[nn].next;
-                                }
-                                if (d >= 2) {
-                                        as[cl].next = nn;
-                                        as[cl].count = j;
-                                        as[cl].from = dptr;
-                                }
+                struct hint *hi = NULL;
+                if (!sweep) {
+                        seed ^= seed << 13;
+                        seed ^= seed >> 7;
+                        seed ^= seed << 17;
+                        hi = &h.h[(seed >> 32) % h.n];
+                        if (seed & 1)
+                                REVIVE(limits.forbid, hi->uoff);
+                        else
+                                limits.avoid[hi->uoff] = hi->dist;
+                }
+                int lvl = sweep ? (int)round : at;
+                ssize_t csize = compress_best(ctx, text, tsize, cand, lvl, params, &limits);
+                if (hi) {
+                        KILL(limits.forbid, hi->uoff);
+                        limits.avoid[hi->uoff] = 0;
+                }
+                st.rounds++;
+                if (csize >= 0 && csize <= best && verify(cand, csize, text, tsize, buf, params)) {
+                        if (csize < best) {
+                                st.improved++;
+                                stale = 0;
                         }
+                        memcpy(out, cand, csize);
+                        best = csize;
+                        at = lvl;
+                        fresh = true;
                 }
-        }
-        int optr = 0;
-        for (int i = 0; i != -1; i = as[i].next) {
-                if (as[i].count < 2)
-                        out[optr] = in[i] & 0x7f;
-                else {
-                        out[optr] = mk_ptr(as[i].count, optr - as[as[i].from].from - 1);
+                if (!sweep && ++stale >= LZJWM_OPTIMIZE_ROUNDS) {
+                        st.converged = true;
+                        break;
                 }
-                as[i].from = optr++;
+                if (seconds > 0 && now() - start >= seconds)
+                        break;
         }
-        free(as);
-        return optr;
+done:
+        st.seconds = now() - start;
+        if (stats)
+                *stats = st;
+        free(text);
+        free(buf);
+        free(cand);
+        free(limits.forbid);
+        free(limits.avoid);
+        free(h.h);
+        lzjwm_ctx_free(ctx);
+        return best;
 }
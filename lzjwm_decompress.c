@@ -5,34 +5,64 @@
 #include "lzjwm.h"
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdbool.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
 
-// deconstruct the byte codes. these include a special case for ZERO_BITS that
-// is generally not needed but may be useful for specific circumstances.
-static uint8_t count(uint8_t c)
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+
+// deconstruct the byte codes. these include a special case for zero bits that
+// is generally not needed but may be useful for specific circumstances. the
+// _f versions take the format, the decoders that can run with any params are
+// written in terms of them and instantiated for each of LZJWM_FORMATS.
+static ALWAYS_INLINE uint8_t count_f(uint8_t c, int cb, int zb)
 {
         if (!(c & 0x80))
                 return 1;
-        if (ZERO_BITS && (c | ((1 << (COUNT_BITS + ZERO_BITS)) - 1)) == 0xff)
-                return (c & ((1 << (COUNT_BITS + ZERO_BITS)) - 1)) + 2;
+        if (zb && (c | ((1 << (cb + zb)) - 1)) == 0xff)
+                return (c & ((1 << (cb + zb)) - 1)) + 2;
         else
-                return COUNT(c);
+                return (c & ((1 << cb) - 1)) + 2;
 }
 
-static uint8_t get_offset(uint8_t c)
+static uint8_t count(uint8_t c)
 {
-        if (ZERO_BITS && (c | ((1 << (COUNT_BITS + ZERO_BITS)) - 1)) == 0xff)
+        return count_f(c, COUNT_BITS, ZERO_BITS);
+}
+
+/* no offset can be this large whatever COUNT_BITS is, must be a power of 2 */
+#define RING 128
+
+static ALWAYS_INLINE uint8_t get_offset_f(uint8_t c, int cb, int zb)
+{
+        if (zb && (c | ((1 << (cb + zb)) - 1)) == 0xff)
                 return 0;
-        return OFFSET(c) + (ZERO_BITS ? 1 : 0);
+        return ((c & 0x7f) >> cb) + (zb ? 1 : 0);
 }
 
-size_t lzjwm_decompressed_size(const char *in, ssize_t isize)      
+static uint8_t get_offset(uint8_t c)
+{
+        return get_offset_f(c, COUNT_BITS, ZERO_BITS);
+}
+
+static ALWAYS_INLINE size_t decompressed_size(const char *in, ssize_t isize, int cb, int zb)
 {
         size_t size = 0;
-        for (int i = 0; (isize == -1 && in[i]) ||  i < isize; i++)
-                size += count(in[i]);
+        for (size_t i = 0; isize == -1 ? in[i] : i < (size_t)isize; i++)
+                size += count_f(in[i], cb, zb);
         return size;
 }
 
+size_t lzjwm_decompressed_size(const char *in, ssize_t isize)      
+{
+        return decompressed_size(in, isize, COUNT_BITS, ZERO_BITS);
+}
+
 // we pass in the whole buffer in addtion to the current location and how many
 // bytes we wish to output. isize == -1 means in is null terminated and howmany
 // == -1 means no limit on number of items output.
@@ -40,25 +70,45 @@ size_t lzjwm_decompressed_size(const char *in, ssize_t isize)
 // this requires no buffers whatsoever.
 
 /* simple structure that contains constant data for decompression so we don't
- * keep passing the same thing to recursive calls. */
+ * keep passing the same thing to recursive calls. if buf is set output is
+ * gathered there and passed to write in chunks rather than to fputc. */
 struct decompress_data {
         const char *input;
-        unsigned input_size;
+        size_t input_size;
+        bool nul_terminated;
         int (*fputc)(int, void *);
+        void (*write)(void *, const char *, size_t);
         void *user;
+        char *buf;
+        size_t bufsize, buflen;
 };
 
-static int _decompress_stream(const struct decompress_data *data,
-                              unsigned iptr,    // current position
-                              unsigned howmany // total needed
-                             )
+static inline void emit(struct decompress_data *data, char ch)
+{
+        if (!data->buf) {
+                data->fputc(ch, data->user);
+                return;
+        }
+        data->buf[data->buflen++] = ch;
+        if (data->buflen == data->bufsize) {
+                data->write(data->user, data->buf, data->buflen);
+                data->buflen = 0;
+        }
+}
+
+static size_t _decompress_stream(struct decompress_data *data,
+                                 size_t iptr,    // current position
+                                 size_t howmany // total needed
+                                )
 {
-        unsigned needed = howmany;
+        size_t needed = howmany;
         while (needed && iptr < data->input_size) {
                 char ch = data->input[iptr++];
-                int len = count(ch);
+                if (!ch && data->nul_terminated)
+                        break;
+                size_t len = count(ch);
                 if (len == 1) {
-                        data->fputc(ch, data->user);
+                        emit(data, ch);
                         needed--;
                 } else {
                         int offset = get_offset(ch);
@@ -76,10 +126,85 @@ static int _decompress_stream(const struct decompress_data *data,
 // be the size of the input, or -1 if the input is null terminated.
 size_t lzjwm_decompress_stream(const char *in, ssize_t isize, int (*fputc)(int c, void *data), void *user)
 {
-        struct decompress_data data = { .input = in, .input_size = isize, .fputc = fputc, .user = user };
+        struct decompress_data data = { .input = in, .input_size = isize, .nul_terminated = isize == -1,
+                                        .fputc = fputc, .user = user };
         return _decompress_stream(&data, 0, -1);
 }
 
+// the same but output is collected in buf and handed to write whenever it
+// fills up, so there is one indirect call per chunk rather than per character.
+size_t lzjwm_decompress_stream_buf(const char *in, ssize_t isize, char *buf, size_t bufsize,
+                                   void (*write)(void *user, const char *buf, size_t len), void *user)
+{
+        struct decompress_data data = { .input = in, .input_size = isize, .nul_terminated = isize == -1,
+                                        .write = write, .user = user, .buf = buf, .bufsize = bufsize };
+        size_t res = _decompress_stream(&data, 0, -1);
+        if (data.buflen)
+                write(user, buf, data.buflen);
+        return res;
+}
+
+// streaming decompression that never re-decodes anything. rather than
+// recursing, matches are copied out of a small ring of the most recent output.
+// a match can only reach back over LOOKBACK input bytes each of which decodes to
+// at most MAX_ZERO_MATCH characters so the ring never needs to be larger than
+// that, 160 bytes with the default settings and 540 at worst for any of
+// LZJWM_FORMATS. the ring doubles as the output buffer and is handed to write
+// each time it fills.
+#define OUT_RING 1024
+#define REACH(cb, zb) (LZJWM_LOOKBACK(cb, zb) * LZJWM_MAX_ZERO_MATCH(cb, zb))
+#define CHECK_REACH(cb, zb) _Static_assert(OUT_RING > REACH(cb, zb), "output ring too small for offsets");
+LZJWM_FORMATS(CHECK_REACH)
+
+static void flush_ring(const char *ring, size_t from, size_t to,
+                       void (*write)(void *user, const char *buf, size_t len), void *user)
+{
+        size_t start = from & (OUT_RING - 1), len = to - from;
+        if (start + len > OUT_RING) {
+                write(user, ring + start, OUT_RING - start);
+                len -= OUT_RING - start;
+                start = 0;
+        }
+        if (len)
+                write(user, ring + start, len);
+}
+
+static ALWAYS_INLINE size_t decompress_ring(const char *in, ssize_t isize,
+                                            void (*write)(void *user, const char *buf, size_t len), void *user,
+                                            int cb, int zb)
+{
+        char ring[OUT_RING];
+        size_t starts[RING];
+        size_t fsize = 0, flushed = 0;
+        for (size_t iptr = 0; iptr < (size_t)isize;) {
+                char ch = in[iptr];
+                if (!(~isize || ch))
+                        break;
+                starts[iptr++ & (RING - 1)] = fsize;
+                int len = count_f(ch, cb, zb);
+                if (fsize + len - flushed > OUT_RING) {
+                        flush_ring(ring, flushed, fsize, write, user);
+                        flushed = fsize;
+                }
+                if (len == 1) {
+                        ring[fsize & (OUT_RING - 1)] = ch;
+                } else {
+                        size_t outf = starts[(iptr - get_offset_f(ch, cb, zb) - 2) & (RING - 1)];
+                        for (int i = 0; i < len; i++)
+                                ring[(fsize + i) & (OUT_RING - 1)] = ring[(outf + i) & (OUT_RING - 1)];
+                }
+                fsize += len;
+        }
+        flush_ring(ring, flushed, fsize, write, user);
+        return fsize;
+}
+
+size_t lzjwm_decompress_ring(const char *in, ssize_t isize,
+                             void (*write)(void *user, const char *buf, size_t len), void *user)
+{
+        return decompress_ring(in, isize, write, user, COUNT_BITS, ZERO_BITS);
+}
+
 // non streaming decompression that uses a buffer. this will be
 // faster but needs to keep the output available.
 //
@@ -88,23 +213,26 @@ size_t lzjwm_decompress_stream(const char *in, ssize_t isize, int (*fputc)(int c
 // you do not already know it.
 //
 // if isize is -1,then the input is assumed to be null terminated.
-size_t lzjwm_decompress(const char *in, ssize_t isize,  char *out)
+//
+// rather than counting back over the input to find where a match's data
+// starts in the output, we remember where the output of each of the last RING
+// input bytes began. no offset can reach back further than that.
+static ALWAYS_INLINE size_t decompress(const char *in, ssize_t isize, char *out, int cb, int zb)
 {
-        int fsize = 0;
-        int iptr = 0;
-        while (iptr < (unsigned)isize) {
-                char ch = in[iptr++];
+        size_t starts[RING];
+        size_t fsize = 0;
+        size_t iptr = 0;
+        while (iptr < (size_t)isize) {
+                char ch = in[iptr];
                 if (!(~isize || ch))
                         break;
-                int len = count(ch);
+                starts[iptr++ & (RING - 1)] = fsize;
+                int len = count_f(ch, cb, zb);
                 if (len == 1) {
                         out[fsize] = ch;
                 } else {
-                        int offset = get_offset(ch);
-                        const char *in_finger = in + iptr - 1;
-                        int outf = fsize;
-                        for (int i = 0; i <= offset; i++)
-                                outf -= count(*--in_finger);
+                        int offset = get_offset_f(ch, cb, zb);
+                        size_t outf = starts[(iptr - offset - 2) & (RING - 1)];
                         for (int i = 0; i < len; i++)
                                 out[fsize + i] = out[outf + i];
                 }
@@ -113,11 +241,396 @@ size_t lzjwm_decompress(const char *in, ssize_t isize,  char *out)
         return fsize;
 }
 
+size_t lzjwm_decompress(const char *in, ssize_t isize,  char *out)
+{
+        return decompress(in, isize, out, COUNT_BITS, ZERO_BITS);
+}
+
+/* a copy of each of the above for every format, picked by params. */
+#define DECODERS(cb, zb) \
+static size_t decompressed_size_##cb##_##zb(const char *in, ssize_t isize) \
+{ \
+        return decompressed_size(in, isize, cb, zb); \
+} \
+static size_t decompress_##cb##_##zb(const char *in, ssize_t isize, char *out) \
+{ \
+        return decompress(in, isize, out, cb, zb); \
+} \
+static size_t decompress_ring_##cb##_##zb(const char *in, ssize_t isize, \
+                                          void (*write)(void *user, const char *buf, size_t len), void *user) \
+{ \
+        return decompress_ring(in, isize, write, user, cb, zb); \
+}
+LZJWM_FORMATS(DECODERS)
+
+static const struct decoders {
+        int cb, zb;
+        size_t (*decompressed_size)(const char *in, ssize_t isize);
+        size_t (*decompress)(const char *in, ssize_t isize, char *out);
+        size_t (*decompress_ring)(const char *in, ssize_t isize,
+                                  void (*write)(void *user, const char *buf, size_t len), void *user);
+} decoders[] = {
+#define DECODER(cb, zb) { cb, zb, decompressed_size_##cb##_##zb, decompress_##cb##_##zb, decompress_ring_##cb##_##zb },
+        LZJWM_FORMATS(DECODER)
+};
+
+static const struct decoders *find_decoders(const struct lzjwm_params *params)
+{
+        int cb = params ? params->count_bits : COUNT_BITS;
+        int zb = params ? params->zero_bits : ZERO_BITS;
+        for (size_t i = 0; i < sizeof(decoders) / sizeof(decoders[0]); i++)
+                if (decoders[i].cb == cb && decoders[i].zb == zb)
+                        return &decoders[i];
+        return NULL;
+}
+
+size_t lzjwm_decompressed_size_params(const char *in, ssize_t isize, const struct lzjwm_params *params)
+{
+        const struct decoders *d = find_decoders(params);
+        return d ? d->decompressed_size(in, isize) : 0;
+}
+
+size_t lzjwm_decompress_params(const char *in, ssize_t isize, char *out, const struct lzjwm_params *params)
+{
+        const struct decoders *d = find_decoders(params);
+        return d ? d->decompress(in, isize, out) : 0;
+}
+
+size_t lzjwm_decompress_ring_params(const char *in, ssize_t isize, const struct lzjwm_params *params,
+                                    void (*write)(void *user, const char *buf, size_t len), void *user)
+{
+        const struct decoders *d = find_decoders(params);
+        return d ? d->decompress_ring(in, isize, write, user) : 0;
+}
+
+/* what decoding a message after a dictionary needs from it: what it decodes
+ * to and where the output of each of its last RING bytes starts, which is all
+ * a copy in the message can reach. */
+struct lzjwm_dict {
+        int cb, zb;
+        size_t dsize, tlen;
+        size_t starts[RING];
+        char text[];
+};
+
+lzjwm_dict_t *lzjwm_dict_new(const char *dict, size_t dsize, const struct lzjwm_params *params)
+{
+        const struct decoders *d = find_decoders(params);
+        if (!d)
+                return NULL;
+        size_t size = d->decompressed_size(dict, dsize);
+        lzjwm_dict_t *res = calloc(1, sizeof(*res) + size + 1);
+        if (!res)
+                return NULL;
+        *res = (lzjwm_dict_t) { .cb = d->cb, .zb = d->zb, .dsize = dsize, .tlen = size };
+        d->decompress(dict, dsize, res->text);
+        for (size_t i = 0, start = 0; i < dsize; i++) {
+                res->starts[i & (RING - 1)] = start;
+                start += count_f(dict[i], d->cb, d->zb);
+        }
+        return res;
+}
+
+void lzjwm_dict_free(lzjwm_dict_t *dict)
+{
+        free(dict);
+}
+
+/* as decompress carrying on after the dictionary, positions count from the
+ * start of its text so a copy below tlen comes from there. */
+ssize_t lzjwm_dict_decompress(const lzjwm_dict_t *dict, const char *in, size_t isize, char *out)
+{
+        size_t starts[RING];
+        memcpy(starts, dict->starts, sizeof(starts));
+        size_t tlen = dict->tlen, fsize = tlen, iptr = dict->dsize;
+        for (size_t i = 0; i < isize; i++) {
+                char ch = in[i];
+                starts[iptr++ & (RING - 1)] = fsize;
+                int len = count_f(ch, dict->cb, dict->zb);
+                if (len == 1) {
+                        out[fsize - tlen] = ch;
+                } else {
+                        size_t outf = starts[(iptr - get_offset_f(ch, dict->cb, dict->zb) - 2) & (RING - 1)];
+                        for (int k = 0; k < len; k++, outf++)
+                                out[fsize - tlen + k] = outf < tlen ? dict->text[outf] : out[outf - tlen];
+                }
+                fsize += len;
+        }
+        return fsize - tlen;
+}
+
+ssize_t lzjwm_decompress_with_dict(const char *dict, size_t dsize, const char *in, size_t isize, char *out,
+                                   const struct lzjwm_params *params)
+{
+        lzjwm_dict_t *d = lzjwm_dict_new(dict, dsize, params);
+        if (!d)
+                return -1;
+        ssize_t res = lzjwm_dict_decompress(d, in, isize, out);
+        lzjwm_dict_free(d);
+        return res;
+}
+
+static int put_buf(int ch, void *user)
+{
+        char **out = user;
+        *(*out)++ = ch;
+        return ch;
+}
+
+// decode just the compressed bytes [start,end) of in. out must point to where
+// the output of in[start] belongs, nothing before it is read so independent
+// slices of one stream may be decoded at the same time. matches that refer to
+// data before the slice are decoded from the compressed data itself.
+size_t lzjwm_decompress_slice(const char *in, size_t start, size_t end, char *out)
+{
+        struct decompress_data data = { .input = in, .input_size = end, .fputc = put_buf };
+        char *optr = out;
+        data.user = &optr;
+        char *starts[RING];
+        size_t iptr = start;
+        while (iptr < end) {
+                starts[iptr & (RING - 1)] = optr;
+                char ch = in[iptr++];
+                int len = count(ch);
+                if (len == 1) {
+                        *optr++ = ch;
+                        continue;
+                }
+                int offset = get_offset(ch);
+                if (iptr < start + offset + 2) {
+                        _decompress_stream(&data, iptr - offset - 2, len);
+                        continue;
+                }
+                char *outf = starts[(iptr - offset - 2) & (RING - 1)];
+                for (int i = 0; i < len; i++)
+                        *optr++ = outf[i];
+        }
+        return optr - out;
+}
+
+
+/* random access. */
+
+int lzjwm_index_build(const char *in, size_t isize, size_t interval, struct lzjwm_index *index)
+{
+        *index = (struct lzjwm_index) { .interval = interval };
+        if (!interval)
+                return -1;
+        size_t total = lzjwm_decompressed_size(in, isize);
+        index->npoints = (total + interval - 1) / interval;
+        index->points = malloc(index->npoints * sizeof(*index->points));
+        if (index->npoints && !index->points)
+                return -1;
+        size_t fsize = 0, k = 0;
+        for (size_t iptr = 0; iptr < isize; iptr++) {
+                size_t len = count(in[iptr]);
+                /* record the byte whose output covers each checkpoint */
+                for (; k < index->npoints && k * interval < fsize + len; k++)
+                        index->points[k] = (struct lzjwm_offset) { .uoff = fsize, .coff = iptr };
+                fsize += len;
+        }
+        return 0;
+}
+
+void lzjwm_index_free(struct lzjwm_index *index)
+{
+        free(index->points);
+        index->points = NULL;
+        index->npoints = 0;
+}
+
+// decode from iptr, throwing away the first skip characters and writing the
+// howmany after that to *out. this works like _decompress_stream, except a
+// match that falls entirely within the part being skipped need not be decoded
+// at all.
+static void _decompress_range(const char *in, size_t isize, size_t iptr, size_t skip, size_t howmany, char **out)
+{
+        size_t needed = skip + howmany;
+        while (needed && iptr < isize) {
+                char ch = in[iptr++];
+                size_t len = count(ch);
+                if (len == 1) {
+                        if (skip)
+                                skip--;
+                        else
+                                *(*out)++ = ch;
+                        needed--;
+                } else if (len <= skip) {
+                        skip -= len;
+                        needed -= len;
+                } else {
+                        size_t nloc = iptr - get_offset(ch) - 2;
+                        if (needed > len) {
+                                _decompress_range(in, isize, nloc, skip, len - skip, out);
+                                needed -= len;
+                                skip = 0;
+                        } else
+                                iptr = nloc;
+                }
+        }
+}
+
+size_t lzjwm_decompress_range(const char *in, size_t isize, const struct lzjwm_index *index,
+                              size_t uoff, size_t len, char *out)
+{
+        struct lzjwm_offset start = { 0, 0 };
+        if (index && index->npoints) {
+                size_t k = uoff / index->interval;
+                start = index->points[k < index->npoints ? k : index->npoints - 1];
+        }
+        char *optr = out;
+        _decompress_range(in, isize, start.coff, uoff - start.uoff, len, &optr);
+        return optr - out;
+}
+
+
+/* the fast decoder handles literals a vector at a time. each of these copies
+ * a whole vector from in to out and returns how many of the bytes were
+ * literals, that is, how far it is to the first byte with the top bit set. */
+
+static ALWAYS_INLINE unsigned literals_word(const char *in, char *out)
+{
+        uint64_t w;
+        memcpy(&w, in, 8);
+        memcpy(out, &w, 8);
+        w &= 0x8080808080808080ULL;
+        if (!w)
+                return 8;
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        return __builtin_clzll(w) >> 3;
+#else
+        return __builtin_ctzll(w) >> 3;
+#endif
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse2")))
+static ALWAYS_INLINE unsigned literals_sse2(const char *in, char *out)
+{
+        __m128i v = _mm_loadu_si128((const __m128i *)in);
+        _mm_storeu_si128((__m128i *)out, v);
+        unsigned m = _mm_movemask_epi8(v);
+        return m ? __builtin_ctz(m) : 16;
+}
+
+__attribute__((target("avx2")))
+static ALWAYS_INLINE unsigned literals_avx2(const char *in, char *out)
+{
+        __m256i v = _mm256_loadu_si256((const __m256i *)in);
+        _mm256_storeu_si256((__m256i *)out, v);
+        unsigned m = _mm256_movemask_epi8(v);
+        return m ? __builtin_ctz(m) : 32;
+}
+#elif defined(__aarch64__)
+static ALWAYS_INLINE unsigned literals_neon(const char *in, char *out)
+{
+        uint8x16_t v = vld1q_u8((const uint8_t *)in);
+        vst1q_u8((uint8_t *)out, v);
+        /* narrowing the 0x00/0xff compare result by 4 bits leaves a nibble per
+         * byte in a 64 bit mask */
+        uint8x16_t top = vcltzq_s8(vreinterpretq_s8_u8(v));
+        uint64_t m = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(top), 4)), 0);
+        return m ? __builtin_ctzll(m) >> 2 : 16;
+}
+#endif
+
+/* the body of the fast decoder, this is instantiated once per vector
+ * width so each one gets the literal scan inlined.
+ *
+ * to keep literal runs cheap, for each of the last RING input bytes we keep the
+ * difference between where its output begins and its own position, this is the
+ * same for every byte in a run of literals. */
+static ALWAYS_INLINE size_t decompress_fast(const char *in, size_t isize, char *out,
+                unsigned (*literals)(const char *, char *), unsigned width)
+{
+        ptrdiff_t delta[RING];
+        size_t fsize = 0, iptr = 0;
+        while (iptr < isize) {
+                char ch = in[iptr];
+                if (!(ch & 0x80)) {
+                        unsigned run = 1;
+                        if (iptr + width <= isize)
+                                run = literals(in + iptr, out + fsize);
+                        else
+                                out[fsize] = ch;
+                        ptrdiff_t d = fsize - iptr;
+                        for (unsigned i = 0; i < run; i++)
+                                delta[(iptr + i) & (RING - 1)] = d;
+                        iptr += run;
+                        fsize += run;
+                        continue;
+                }
+                delta[iptr & (RING - 1)] = fsize - iptr;
+                iptr++;
+                int len = count(ch);
+                size_t src = iptr - get_offset(ch) - 2;
+                size_t outf = src + delta[src & (RING - 1)];
+                /* matches are copied 8 bytes at a time, one copy covers them
+                 * with the default format, unless the source overlaps the
+                 * destination. */
+                if (fsize - outf >= 8)
+                        for (int i = 0; i < len; i += 8)
+                                memcpy(out + fsize + i, out + outf + i, 8);
+                else
+                        for (int i = 0; i < len; i++)
+                                out[fsize + i] = out[outf + i];
+                fsize += len;
+        }
+        return fsize;
+}
+
+static size_t decompress_word(const char *in, size_t isize, char *out)
+{
+        return decompress_fast(in, isize, out, literals_word, 8);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse2")))
+static size_t decompress_sse2(const char *in, size_t isize, char *out)
+{
+        return decompress_fast(in, isize, out, literals_sse2, 16);
+}
+
+__attribute__((target("avx2")))
+static size_t decompress_avx2(const char *in, size_t isize, char *out)
+{
+        return decompress_fast(in, isize, out, literals_avx2, 32);
+}
+#elif defined(__aarch64__)
+static size_t decompress_neon(const char *in, size_t isize, char *out)
+{
+        return decompress_fast(in, isize, out, literals_neon, 16);
+}
+#endif
+
+/* pick the widest variant the cpu we are running on supports */
+static size_t (*pick_fast(void))(const char *, size_t, char *)
+{
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+                return decompress_avx2;
+        if (__builtin_cpu_supports("sse2"))
+                return decompress_sse2;
+#elif defined(__aarch64__)
+        return decompress_neon;
+#endif
+        return decompress_word;
+}
+
+size_t lzjwm_decompress_fast(const char *in, size_t isize, char *out)
+{
+        static size_t (*fast)(const char *, size_t, char *);
+        if (!fast)
+                fast = pick_fast();
+        return fast(in, isize, out);
+}
+
 
 /* dump representation of encoded form to  stdout */
 void lzjwm_dump(char *in, size_t isize)
 {
-        for (int i = 0; i < isize; i++) {
+        for (size_t i = 0; i < isize; i++) {
                 if (in[i] & 0x80) {
                         printf("(%i,%i)", get_offset(in[i]), count(in[i]));
                 } else {
@@ -126,3 +639,171 @@ void lzjwm_dump(char *in, size_t isize)
         }
 }
 
+
+/* working out what the recursive decoder costs. for each of the last RING
+ * bytes we keep, for every n up to what it decodes to, how many compressed
+ * bytes the decoder reads to get the first n characters out of it, counting
+ * the byte itself, and how many calls deep it goes beneath the current one
+ * doing so. a copy reads forward from its source until it has enough, using
+ * what was already found for the bytes it passes over, so each byte takes
+ * one walk of at most MAX_COPY steps. */
+#define MAX_COPY 33
+#define CHECK_COPY(cb, zb) _Static_assert(LZJWM_MAX_ZERO_MATCH(cb, zb) <= MAX_COPY, "MAX_COPY too small");
+LZJWM_FORMATS(CHECK_COPY)
+
+struct copy_work {
+        uint64_t cost[MAX_COPY];
+        uint8_t depth[MAX_COPY];
+};
+
+static bool copy_work(const char *in, size_t t, struct copy_work *ring, int cb, int zb)
+{
+        struct copy_work *w = &ring[t & (RING - 1)];
+        uint8_t ch = in[t];
+        if (!(ch & 0x80)) {
+                w->cost[0] = 1;
+                w->depth[0] = 0;
+                return true;
+        }
+        /* the decoder has already moved past t when it subtracts 2 */
+        size_t back = get_offset_f(ch, cb, zb) + 1;
+        if (back > t)
+                return false;
+        int len = count_f(ch, cb, zb), m = 1, d = 0;
+        uint64_t c = 1;
+        /* this never gets past t, by the time it reaches t at least one
+         * character is done and t decodes to len so whatever is left is
+         * finished there. */
+        for (size_t k = t - back; m <= len; k++) {
+                uint8_t kc = in[k];
+                if (!(kc & 0x80)) {
+                        c++;
+                        w->cost[m - 1] = c;
+                        w->depth[m - 1] = d;
+                        m++;
+                        continue;
+                }
+                /* the first few characters of k finish off a walk that only
+                 * needed that many, the decoder jumps to k's source without
+                 * recursing. */
+                const struct copy_work *kw = &ring[k & (RING - 1)];
+                int kl = count_f(kc, cb, zb), done = m - 1;
+                for (; m <= len && m - done <= kl; m++) {
+                        w->cost[m - 1] = c + kw->cost[m - done - 1];
+                        w->depth[m - 1] = d > kw->depth[m - done - 1] ? d : kw->depth[m - done - 1];
+                }
+                /* longer walks need all of k so the decoder recurses */
+                c += kw->cost[kl - 1];
+                if (d < 1 + kw->depth[kl - 1])
+                        d = 1 + kw->depth[kl - 1];
+        }
+        return true;
+}
+
+int lzjwm_decode_work_each(const char *in, size_t isize, const struct lzjwm_params *params, struct lzjwm_work *work,
+                           void (*each)(void *user, size_t coff, size_t uoff, size_t len, size_t cost), void *user)
+{
+        if (!lzjwm_params_ok(params))
+                return -1;
+        int cb = params ? params->count_bits : COUNT_BITS;
+        int zb = params ? params->zero_bits : ZERO_BITS;
+        struct copy_work *ring = malloc(RING * sizeof(*ring));
+        if (!ring)
+                return -1;
+        *work = (struct lzjwm_work) { 0 };
+        size_t uoff = 0;
+        for (size_t t = 0; t < isize; t++) {
+                if (!copy_work(in, t, ring, cb, zb)) {
+                        free(ring);
+                        return -1;
+                }
+                /* at the top level the decoder wants everything so every
+                 * copy is a recursive call */
+                const struct copy_work *w = &ring[t & (RING - 1)];
+                int len = count_f(in[t], cb, zb);
+                uint64_t cost = w->cost[len - 1];
+                work->total += cost;
+                if (cost > work->max)
+                        work->max = cost;
+                if (len > 1 && work->depth < 1u + w->depth[len - 1])
+                        work->depth = 1 + w->depth[len - 1];
+                if (each)
+                        each(user, t, uoff, len, cost);
+                uoff += len;
+        }
+        free(ring);
+        return 0;
+}
+
+int lzjwm_decode_work(const char *in, size_t isize, const struct lzjwm_params *params, struct lzjwm_work *work)
+{
+        return lzjwm_decode_work_each(in, isize, params, work, NULL, NULL);
+}
+
+/* a record being decoded while working out what it costs */
+struct active {
+        size_t r, left;
+};
+
+static int cmp_record(const void *a, const void *b)
+{
+        const struct active *x = a, *y = b;
+        return (x->left > y->left) - (x->left < y->left);
+}
+
+int lzjwm_analyze(const char *in, size_t isize, const struct lzjwm_params *params,
+                  const struct lzjwm_record *records, size_t nrecords, struct lzjwm_record_work *work)
+{
+        if (!lzjwm_params_ok(params))
+                return -1;
+        int cb = params ? params->count_bits : COUNT_BITS;
+        int zb = params ? params->zero_bits : ZERO_BITS;
+        struct copy_work *ring = malloc(RING * sizeof(*ring));
+        /* the records in the order they start in, then the ones being
+         * decoded at the current byte */
+        struct active *order = malloc((nrecords + 1) * sizeof(*order));
+        struct active *active = malloc((nrecords + 1) * sizeof(*active));
+        int res = -1;
+        if (!ring || !order || !active)
+                goto done;
+        for (size_t r = 0; r < nrecords; r++) {
+                order[r] = (struct active) { .r = r, .left = records[r].coff };
+                work[r] = (struct lzjwm_record_work) { 0 };
+        }
+        qsort(order, nrecords, sizeof(*order), cmp_record);
+        size_t next = 0, nactive = 0;
+        for (size_t t = 0; t < isize && (next < nrecords || nactive); t++) {
+                if (!copy_work(in, t, ring, cb, zb))
+                        goto done;
+                for (; next < nrecords && order[next].left == t; next++)
+                        if (records[order[next].r].len)
+                                active[nactive++] = (struct active) { order[next].r, records[order[next].r].len };
+                const struct copy_work *w = &ring[t & (RING - 1)];
+                int len = count_f(in[t], cb, zb);
+                /* the same as the top level of the walk in copy_work, a copy
+                 * the record needs all of is a recursive call and one that
+                 * finishes it is jumped to. */
+                for (size_t i = 0; i < nactive;) {
+                        struct active *a = &active[i];
+                        struct lzjwm_record_work *rw = &work[a->r];
+                        size_t n = a->left > (size_t)len ? (size_t)len : a->left;
+                        size_t depth = w->depth[n - 1] + (len > 1 && a->left > (size_t)len);
+                        rw->touched += w->cost[n - 1];
+                        if (rw->depth < depth)
+                                rw->depth = depth;
+                        a->left = a->left > (size_t)len ? a->left - len : 0;
+                        if (a->left)
+                                i++;
+                        else
+                                *a = active[--nactive];
+                }
+        }
+        /* anything left over starts or ends past the end of the data */
+        if (next == nrecords && !nactive)
+                res = 0;
+done:
+        free(ring);
+        free(order);
+        free(active);
+        return res;
+}
@@ -0,0 +1,173 @@
+/* train a dictionary for compressing many short messages. */
+
+#define _GNU_SOURCE
+#include "lzjwm.h"
+#include <stdint.h>
+#include <string.h>
+
+/* only this much sample text is counted and this many samples are used to
+ * choose between candidate dictionaries. */
+#define COUNT_BYTES (1 << 20)
+#define EVAL_SAMPLES 2000
+#define MIN_GRAM 3
+#define MAX_GRAM 8
+#define MAX_PICKS 64
+
+/* a substring of up to MAX_GRAM characters packed into a word. */
+struct gram {
+        uint64_t key;
+        uint32_t len, count;
+};
+
+static uint64_t pack(const char *s, size_t len)
+{
+        uint64_t key = 0;
+        for (size_t i = 0; i < len; i++)
+                key = key << 8 | (uint8_t)s[i];
+        return key;
+}
+
+static void unpack(uint64_t key, size_t len, char *s)
+{
+        while (len--) {
+                s[len] = key;
+                key >>= 8;
+        }
+}
+
+static int cmp_gram(const void *x, const void *y)
+{
+        const struct gram *a = x, *b = y;
+        if (a->len != b->len)
+                return a->len < b->len ? -1 : 1;
+        return (a->key > b->key) - (a->key < b->key);
+}
+
+/* a copy saves all but one of the characters it stands for. */
+static uint64_t score(const struct gram *g)
+{
+        return (uint64_t)g->count * (g->len - 1);
+}
+
+static int cmp_score(const void *x, const void *y)
+{
+        uint64_t a = score(x), b = score(y);
+        if (a != b)
+                return a > b ? -1 : 1;
+        return cmp_gram(x, y);
+}
+
+/* sort and merge equal grams adding up their counts, returns how many are
+ * left. with once each is counted a single time. */
+static size_t merge(struct gram *g, size_t n, bool once)
+{
+        qsort(g, n, sizeof(*g), cmp_gram);
+        size_t k = 0;
+        for (size_t i = 0; i < n; i++) {
+                if (k && !cmp_gram(&g[k - 1], &g[i]))
+                        g[k - 1].count += once ? 0 : g[i].count;
+                else
+                        g[k++] = g[i];
+        }
+        return k;
+}
+
+/* count how many samples every substring appears in. */
+static ssize_t count_grams(const struct lzjwm_input *samples, size_t n, size_t max, struct gram **res)
+{
+        size_t total = 0, ngrams = 0;
+        for (size_t i = 0; i < n && total < COUNT_BYTES; i++)
+                total += samples[i].len;
+        struct gram *g = malloc((total * (max - MIN_GRAM + 1) + 1) * sizeof(*g));
+        if (!g)
+                return -1;
+        total = 0;
+        for (size_t i = 0; i < n && total < COUNT_BYTES; i++) {
+                const char *s = samples[i].data;
+                size_t len = samples[i].len, first = ngrams;
+                total += len;
+                for (size_t j = 0; j < len; j++)
+                        for (size_t k = MIN_GRAM; k <= max && j + k <= len; k++)
+                                g[ngrams++] = (struct gram) { pack(s + j, k), k, 1 };
+                ngrams = first + merge(g + first, ngrams - first, true);
+        }
+        *res = g;
+        return merge(g, ngrams, false);
+}
+
+/* the dictionary text is the picks in reverse order so the best is closest
+ * to the messages. */
+static size_t join(const struct gram *picks, size_t n, char *text)
+{
+        size_t len = 0;
+        for (size_t i = n; i-- > 0;) {
+                unpack(picks[i].key, picks[i].len, text + len);
+                len += picks[i].len;
+        }
+        return len;
+}
+
+/* total compressed size of the evaluation samples with a dictionary. */
+static size_t evaluate(lzjwm_ctx_t *ctx, const char *dict, size_t dsize, const struct lzjwm_input *samples, size_t n,
+                       char *out, int level, const struct lzjwm_params *params)
+{
+        size_t total = 0;
+        for (size_t i = 0; i < n; i++) {
+                ssize_t csize = lzjwm_ctx_compress_with_dict(ctx, dict, dsize, samples[i].data, samples[i].len, out,
+                                                             level, params);
+                total += csize < 0 ? samples[i].len : csize;
+        }
+        return total;
+}
+
+ssize_t lzjwm_train_dict(const struct lzjwm_input *samples, size_t n, char *dict, int level,
+                         const struct lzjwm_params *params)
+{
+        struct lzjwm_params p = params ? *params : (struct lzjwm_params)LZJWM_DEFAULT_PARAMS;
+        if (!lzjwm_params_ok(&p))
+                return -1;
+        size_t max = LZJWM_MAX_MATCH(p.count_bits), biggest = 0, neval = n < EVAL_SAMPLES ? n : EVAL_SAMPLES;
+        if (max > MAX_GRAM)
+                max = MAX_GRAM;
+        for (size_t i = 0; i < neval; i++)
+                biggest = samples[i].len > biggest ? samples[i].len : biggest;
+        struct gram *g = NULL;
+        ssize_t ngrams = count_grams(samples, n, max, &g);
+        lzjwm_ctx_t *ctx = lzjwm_ctx_new(NULL, 0);
+        char text[MAX_PICKS * MAX_GRAM], cand[MAX_PICKS * MAX_GRAM], *out = malloc(biggest + 1);
+        ssize_t res = -1;
+        if (ngrams < 0 || !ctx || !out)
+                goto done;
+        qsort(g, ngrams, sizeof(*g), cmp_score);
+
+        /* take the best scoring strings not already in the dictionary while it
+         * still fits, keeping whichever number of them does best. once it is
+         * full give up after a few more don't fit. */
+        struct gram picks[MAX_PICKS];
+        size_t npicks = 0, misses = 0, best_total = evaluate(ctx, NULL, 0, samples, neval, out, level, &p);
+        res = 0;
+        for (ssize_t i = 0; i < ngrams && npicks < MAX_PICKS && g[i].count > 1 && misses < MAX_PICKS; i++) {
+                char s[MAX_GRAM];
+                unpack(g[i].key, g[i].len, s);
+                if (memmem(text, join(picks, npicks, text), s, g[i].len))
+                        continue;
+                picks[npicks] = g[i];
+                ssize_t dsize = lzjwm_ctx_compress_params(ctx, text, join(picks, npicks + 1, text), cand, level, &p);
+                if (dsize < 0 || dsize > LZJWM_LOOKBACK(p.count_bits, p.zero_bits)) {
+                        misses++;
+                        continue;
+                }
+                npicks++;
+                size_t total = evaluate(ctx, cand, dsize, samples, neval, out, level, &p);
+                if (total < best_total) {
+                        best_total = total;
+                        memcpy(dict, cand, dsize);
+                        res = dsize;
+                }
+        }
+done:
+        free(g);
+        free(out);
+        lzjwm_ctx_free(ctx);
+        return res;
+}
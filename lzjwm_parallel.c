@@ -0,0 +1,200 @@
+/* multi threaded versions of the encoder and decoder for large inputs. */
+
+#include "lzjwm.h"
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* a very simple thread pool, the threads pull job numbers off a shared
+ * counter until they run out. */
+struct pool {
+        pthread_mutex_t lock;
+        size_t next, njobs;
+        void (*fn)(void *arg, size_t job);
+        void *arg;
+};
+
+static void *worker(void *data)
+{
+        struct pool *pool = data;
+        for (;;) {
+                pthread_mutex_lock(&pool->lock);
+                size_t job = pool->next++;
+                pthread_mutex_unlock(&pool->lock);
+                if (job >= pool->njobs)
+                        break;
+                pool->fn(pool->arg, job);
+        }
+        return NULL;
+}
+
+/* run fn(arg, job) for every job in [0,njobs) on nthreads threads, the
+ * calling thread is one of them. nthreads <= 0 means one per cpu. */
+static void parallel_for(int nthreads, size_t njobs, void (*fn)(void *arg, size_t job), void *arg)
+{
+        struct pool pool = { .lock = PTHREAD_MUTEX_INITIALIZER, .njobs = njobs, .fn = fn, .arg = arg };
+        if (nthreads <= 0)
+                nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+        if (nthreads > njobs)
+                nthreads = njobs;
+        pthread_t threads[nthreads > 1 ? nthreads - 1 : 1];
+        int started = 0;
+        for (; started < nthreads - 1; started++)
+                if (pthread_create(&threads[started], NULL, worker, &pool))
+                        break;
+        worker(&pool);
+        for (int i = 0; i < started; i++)
+                pthread_join(threads[i], NULL);
+}
+
+struct compress_job {
+        const char *in;
+        size_t isize, block_size;
+        int level;
+        char *out;
+        ssize_t *sizes;
+};
+
+/* each block is compressed in place at the same offset in out as it has in
+ * the input, since it can never grow it can't overrun the next one. */
+static void compress_block(void *arg, size_t b)
+{
+        struct compress_job *job = arg;
+        size_t start = b * job->block_size;
+        size_t len = job->isize - start < job->block_size ? job->isize - start : job->block_size;
+        job->sizes[b] = lzjwm_compress_level(job->in + start, len, job->out + start, job->level);
+}
+
+ssize_t lzjwm_compress_parallel(const char *in, size_t isize, int nthreads, size_t block_size, int level, char *out, struct lzjwm_offset *index)
+{
+        if (!block_size)
+                return -1;
+        size_t nblocks = (isize + block_size - 1) / block_size;
+        struct compress_job job = { .in = in, .isize = isize, .block_size = block_size, .level = level, .out = out };
+        job.sizes = malloc(nblocks * sizeof(ssize_t));
+        if (!job.sizes && nblocks)
+                return -1;
+        parallel_for(nthreads, nblocks, compress_block, &job);
+        size_t optr = 0;
+        for (size_t b = 0; b < nblocks; b++) {
+                if (job.sizes[b] < 0) {
+                        free(job.sizes);
+                        return -1;
+                }
+                if (index)
+                        index[b] = (struct lzjwm_offset) { .uoff = b * block_size, .coff = optr };
+                memmove(out + optr, out + b * block_size, job.sizes[b]);
+                optr += job.sizes[b];
+        }
+        free(job.sizes);
+        return optr;
+}
+
+struct decompress_job {
+        const char *in;
+        size_t isize, slice_size;
+        char *out;
+        size_t *offsets;
+};
+
+static size_t slice_end(const struct decompress_job *job, size_t s)
+{
+        size_t end = (s + 1) * job->slice_size;
+        return end < job->isize ? end : job->isize;
+}
+
+static void size_slice(void *arg, size_t s)
+{
+        struct decompress_job *job = arg;
+        size_t start = s * job->slice_size;
+        job->offsets[s] = lzjwm_decompressed_size(job->in + start, slice_end(job, s) - start);
+}
+
+static void decompress_slice(void *arg, size_t s)
+{
+        struct decompress_job *job = arg;
+        lzjwm_decompress_slice(job->in, s * job->slice_size, slice_end(job, s), job->out + job->offsets[s]);
+}
+
+/* don't bother splitting the input finer than this */
+#define MIN_SLICE 4096
+
+size_t lzjwm_decompress_parallel(const char *in, size_t isize, char *out, int nthreads)
+{
+        if (nthreads <= 0)
+                nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+        /* a few slices per thread evens out the load */
+        size_t nslices = nthreads * 4;
+        struct decompress_job job = { .in = in, .isize = isize, .out = out };
+        job.slice_size = (isize + nslices - 1) / nslices;
+        if (job.slice_size < MIN_SLICE)
+                job.slice_size = MIN_SLICE;
+        nslices = (isize + job.slice_size - 1) / job.slice_size;
+        job.offsets = malloc(nslices * sizeof(size_t));
+        if (!job.offsets)
+                return lzjwm_decompress(in, isize, out);
+        /* find how much each slice decodes to then turn that into where each
+         * one's output begins. */
+        parallel_for(nthreads, nslices, size_slice, &job);
+        size_t total = 0;
+        for (size_t s = 0; s < nslices; s++) {
+                size_t n = job.offsets[s];
+                job.offsets[s] = total;
+                total += n;
+        }
+        parallel_for(nthreads, nslices, decompress_slice, &job);
+        free(job.offsets);
+        return total;
+}
+
+static const struct lzjwm_params formats[] = {
+#define PARAMS(cb, zb) { cb, zb },
+        LZJWM_FORMATS(PARAMS)
+};
+
+struct tune_job {
+        const char *in;
+        size_t isize;
+        int level;
+        struct lzjwm_tune *results;
+};
+
+static double cpu_time(void)
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+        return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void tune_format(void *arg, size_t f)
+{
+        struct tune_job *job = arg;
+        struct lzjwm_tune *r = &job->results[f];
+        *r = (struct lzjwm_tune) { .params = formats[f], .size = -1 };
+        char *out = malloc(job->isize ? job->isize : 1);
+        if (!out)
+                return;
+        /* thread time so the others running alongside don't count */
+        double start = cpu_time();
+        r->size = lzjwm_compress_params(job->in, job->isize, out, job->level, &r->params);
+        r->seconds = cpu_time() - start;
+        if (r->size >= 0 && lzjwm_decode_work(out, r->size, &r->params, &r->work) < 0)
+                r->size = -1;
+        free(out);
+}
+
+int lzjwm_tune(const char *in, size_t isize, int level, int nthreads, struct lzjwm_tune *results)
+{
+        struct tune_job job = { .in = in, .isize = isize, .level = level, .results = results };
+        parallel_for(nthreads, LZJWM_NFORMATS, tune_format, &job);
+        int best = -1;
+        for (int f = 0; f < LZJWM_NFORMATS; f++) {
+                if (results[f].size < 0)
+                        continue;
+                if (best < 0 || results[f].size < results[best].size
+                    || (results[f].size == results[best].size && results[f].work.total < results[best].work.total))
+                        best = f;
+        }
+        return best;
+}
@@ -16,12 +16,12 @@
 
 extern inline void *rb_ptr(const rb_t *rb);
 extern inline void *rb_endptr(const rb_t *rb);
-extern inline int rb_len(const rb_t *rb);
-extern inline int rb_red_zone(const rb_t *rb);
+extern inline size_t rb_len(const rb_t *rb);
+extern inline size_t rb_red_zone(const rb_t *rb);
 
 //extern inline void rb_clear(rb_t *rb);
 
-extern inline int fifo_len(const fifo_t *fifo);
+extern inline size_t fifo_len(const fifo_t *fifo);
 extern inline void *fifo_head(const fifo_t *fifo);
 extern inline bool fifo_is_empty(const fifo_t *fifo);
 extern inline void fifo_discard(fifo_t *fifo);
@@ -38,7 +38,7 @@ rb_grow(rb_t *rb, size_t sz)
 {
         assert(rb->len <= rb->size);
         assert(!rb->size || rb->buf);
-        unsigned osz = rb->size;
+        size_t osz = rb->size;
         while (rb->len + sz > osz)
                 osz = osz + (osz >> 1) + 8;
         if (osz != rb->size) {
@@ -174,13 +174,12 @@ rb_puts(char *str, rb_t *rb)
 /* Copy part of rb2 and append it to rb, returns a pointer into rb's buffer where the
  * extracted data lives. */
 void *
-rb_extract(rb_t *rb, const rb_t *rb2, unsigned loc, size_t len)
+rb_extract(rb_t *rb, const rb_t *rb2, size_t loc, size_t len)
 {
-        ssize_t nlen = len;
-        if (loc + len > rb->len)
-                nlen -= loc + len - rb->len;
-        if (nlen <  0)
+        if (loc >= rb2->len)
                 return rb_endptr(rb);
+        if (len > rb2->len - loc)
+                len = rb2->len - loc;
         return rb_append(rb, (char *)rb_ptr(rb2) + loc, len);
 }
 
@@ -192,7 +191,7 @@ rb_extract(rb_t *rb, const rb_t *rb2, unsigned loc, size_t len)
  * one past the end of the buffer is moved as well to preserve stringification.
  */
 void *
-rb_insert_space(rb_t *rb, unsigned loc, size_t len)
+rb_insert_space(rb_t *rb, size_t loc, size_t len)
 {
         assert(rb->len <= rb->size);
         assert((rb->buf && rb->size) || (!rb->buf && !rb->size));
@@ -215,7 +214,7 @@ rb_insert_space(rb_t *rb, unsigned loc, size_t len)
  * range specified. loc may be beyond the end of the buffer.
  * returns pointer to the beginning of the changed memory. */
 void *
-rb_memset(rb_t *rb, char what, unsigned loc, size_t len)
+rb_memset(rb_t *rb, char what, size_t loc, size_t len)
 {
         if (loc + len > rb->len)
                 rb_resize(rb, loc + len, true);
@@ -228,7 +227,7 @@ rb_memset(rb_t *rb, char what, unsigned loc, size_t len)
  * to the hole. one past the end of the buffer is also moved to preserve
  * terminators. */
 void *
-rb_insert(rb_t *rb, unsigned loc, char *data, size_t len)
+rb_insert(rb_t *rb, size_t loc, char *data, size_t len)
 {
         return memcpy(rb_insert_space(rb, loc, len), data, len);
 }
@@ -238,7 +237,7 @@ rb_insert(rb_t *rb, unsigned loc, char *data, size_t len)
  * when moving data one char past the end is moved to preserve null terminators. */
 
 void
-rb_delete(rb_t *rb, unsigned loc, size_t len)
+rb_delete(rb_t *rb, size_t loc, size_t len)
 {
         assert(loc <= rb->len);
         assert(rb->len <= rb->size);
@@ -268,7 +267,7 @@ rb_stringize(rb_t *rb)
         return rb_ptr(rb);
 }
 
-void *rb_peek(rb_t *rb, int n)
+void *rb_peek(rb_t *rb, size_t n)
 {
         if (n <= rb->len) {
                 return rb_endptr(rb) - n;
@@ -299,7 +298,7 @@ void *rb_take(rb_t *rb)
         return r;
 }
 
-void *rb_pop(rb_t *rb, int n)
+void *rb_pop(rb_t *rb, size_t n)
 {
         if (n <= rb->len) {
                 rb->len -= n;
@@ -307,7 +306,7 @@ void *rb_pop(rb_t *rb, int n)
         } else
                 return NULL;
 }
-void *rb_push(rb_t *rb, int n)
+void *rb_push(rb_t *rb, size_t n)
 {
         rb_grow(rb, n);
         void *ret = rb->buf + rb->len;
@@ -349,7 +348,7 @@ ssize_t
 rb_fread(rb_t *rb, FILE *fh, size_t n)
 {
         ssize_t tr = 0;
-        while (!feof(fh) && tr <= n) {
+        while (!feof(fh) && (size_t)tr < n) {
                 char buf[4096];
                 size_t res = fread(buf, 1, __MIN(n - tr, sizeof(buf)), fh);
                 rb_append(rb, buf, res);
@@ -13,8 +13,8 @@ typedef struct rb rb_t;
 
 struct rb {
         void *buf;
-        int len;
-        int size;
+        size_t len;
+        size_t size;
 };
 
 /* This should be used to initialize new buffers.
@@ -88,7 +88,7 @@ typedef int (*rb_cmpfunc)(const void *, const void *);
 
 /* this iterates over pairs of index,value so you can get at the index too. This
  * also allows for the underlying buffer to be mutated. */
-#define RB_FOR_ENUM(t,var,rb)  for (struct { int k; t *v; } var = { .k = 0, .v = RBP(t,rb) }; var.k < (int)RB_NITEMS(t, rb); var.k++, var.v = RBP(t,rb) + var.k)
+#define RB_FOR_ENUM(t,var,rb)  for (struct { size_t k; t *v; } var = { .k = 0, .v = RBP(t,rb) }; var.k < RB_NITEMS(t, rb); var.k++, var.v = RBP(t,rb) + var.k)
 
 inline void *rb_ptr(const rb_t *rb)
 {
@@ -98,12 +98,12 @@ inline void *rb_endptr(const rb_t *rb)
 {
         return rb->buf + rb->len;
 }
-inline int rb_len(const rb_t *rb)
+inline size_t rb_len(const rb_t *rb)
 {
         return rb->len;
 }
 /* how much space we can safely use past the end of the buffer */
-inline int rb_red_zone(const rb_t *rb)
+inline size_t rb_red_zone(const rb_t *rb)
 {
         return rb->size - rb->len;
 }
@@ -123,15 +123,15 @@ void *rb_append(rb_t *rb, void *data, size_t len);
  * the newly extracted data. will copy what it can if an invalid range is
  * selected. If you need to know how many bytes were copied, check rb_len on the
  * target buffer. */
-void *rb_extract(rb_t *rb, const rb_t *rb2, unsigned loc, size_t len);
-void *rb_insert(rb_t *rb, unsigned loc, char *data, size_t len);
-void *rb_insert_space(rb_t *rb, unsigned loc, size_t len);
-void *rb_memset(rb_t *rb, char what, unsigned loc, size_t len);
-void *rb_peek(rb_t *rb, int n);
-void *rb_pop(rb_t *rb, int n);
-void *rb_push(rb_t *rb, int n);
+void *rb_extract(rb_t *rb, const rb_t *rb2, size_t loc, size_t len);
+void *rb_insert(rb_t *rb, size_t loc, char *data, size_t len);
+void *rb_insert_space(rb_t *rb, size_t loc, size_t len);
+void *rb_memset(rb_t *rb, char what, size_t loc, size_t len);
+void *rb_peek(rb_t *rb, size_t n);
+void *rb_pop(rb_t *rb, size_t n);
+void *rb_push(rb_t *rb, size_t n);
 void *rb_set(rb_t *rb, void *data, size_t len);
-void rb_delete(rb_t *rb, unsigned loc, size_t len);
+void rb_delete(rb_t *rb, size_t loc, size_t len);
 void rb_resize(rb_t *rb, size_t len, bool preserve);
 void rb_resize_fill(rb_t *rb, size_t len, char fillvalue);
 void *rb_calloc(rb_t *rb, size_t len);
@@ -199,12 +199,12 @@ typedef struct fifo fifo_t;
 
 struct fifo {
         struct rb rb;
-        unsigned offset;
+        size_t offset;
 };
 
 #define FIFO_BLANK  {RB_BLANK, 0}
 
-inline int fifo_len(const fifo_t *fifo)
+inline size_t fifo_len(const fifo_t *fifo)
 {
         return fifo->rb.len - fifo->offset;
 }
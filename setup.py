@@ -0,0 +1,12 @@
+# builds the optional _lzjwm module that lzjwm.py uses to run the C encoder
+# and decoder, "make python" or "python3 setup.py build_ext --inplace".
+
+from setuptools import setup, Extension
+
+setup(
+    name='lzjwm',
+    description='lzjwm compressor/decompressor',
+    py_modules=['lzjwm'],
+    ext_modules=[Extension('_lzjwm', ['_lzjwm.c', 'lzjwm_compress.c', 'lzjwm_decompress.c'],
+                           depends=['lzjwm.h'], extra_compile_args=['-Os'])],
+)
@@ -3,10 +3,16 @@
 
 /* absolute minimal lzjwm decoder */
 
+#ifndef COUNT_BITS
 #define COUNT_BITS 2
+#endif
+#ifndef ZERO_BITS
+#define ZERO_BITS 0
+#endif
 
 #define COUNT(x) (((x) & ((1 << COUNT_BITS) - 1)) + 2)
 #define OFFSET(x) (((x) & 0x7f) >> COUNT_BITS)
+#define ZERO_MASK ((1 << (COUNT_BITS + ZERO_BITS)) - 1)
 
 // print characters from compressed 'data' starting at 'location'
 // stopping on a null character or after count characters have been printed.
@@ -14,6 +20,8 @@
 // format
 // 0xxxxxxx - literal character xxxxxxx
 // 1ooooocc - copy cc + 2 characters from encoded data offset ooooo
+// 1111zzcc - with ZERO_BITS, copy zzcc + 2 characters from offset 0, the
+//            other offsets are one more than ooooo
 
 void lzjwm_decompress(char *data, unsigned location, unsigned count)
 {
@@ -23,8 +31,12 @@ void lzjwm_decompress(char *data, unsigned location, unsigned count)
                         putchar(ch);
                         count--;
                 } else {
-                        int nloc = location - OFFSET(ch) - 2;
+                        int nloc = location - OFFSET(ch) - 2 - (ZERO_BITS ? 1 : 0);
                         int len = COUNT(ch);
+                        if (ZERO_BITS && ((unsigned char)ch | ZERO_MASK) == 0xff) {
+                                nloc = location - 2;
+                                len = (ch & ZERO_MASK) + 2;
+                        }
                         if (count > len) {
                                 lzjwm_decompress(data, nloc, len);
                                 count -= len;
@@ -35,7 +47,7 @@ void lzjwm_decompress(char *data, unsigned location, unsigned count)
 }
 
 
-#if 1
+#ifndef TINY_LZJWM_NO_MAIN
 
 
 
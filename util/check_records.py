@@ -0,0 +1,29 @@
+#!/usr/bin/python3
+
+# check that every record in yaml written by lzjwm.py -l -f yaml decodes to
+# the line of the input it came from.
+#
+# usage: check_records.py data.yaml input [-0]
+
+import io
+import os
+import sys
+import yaml
+
+sys.path.insert(0, os.path.join(os.path.dirname(__file__), '..'))
+import lzjwm  # noqa: E402
+
+with open(sys.argv[1]) as fh:
+    doc = yaml.load(fh, Loader=getattr(yaml, 'CSafeLoader', yaml.SafeLoader))
+with open(sys.argv[2], 'rb') as fh:
+    lines = fh.read().splitlines()
+terminator = b'\0' if '-0' in sys.argv[3:] else b''
+bad = 0
+for part in doc['parts']:
+    want = lines[part['name']] + terminator
+    out = io.BytesIO()
+    lzjwm.decompress(doc['raw'], start=part['compressed_offset'], howmany=len(want), output=out)
+    if out.getvalue() != want:
+        print(f"record {part['name']}: expected {want!r} got {out.getvalue()!r}")
+        bad += 1
+sys.exit(1 if bad else 0)
@@ -66,10 +66,10 @@ for fn in sorted(glob.glob(base + '/*')):
     status = call(['diff', baseout + '.decompressed', fn], result, status)
     status = call(
         ['diff', baseout + '.decompressed_stream', fn], result, status)
-    status = call(['./lzjwm.py', '-d', baseout + '.lzjwm', '-o', baseout + '.decompressed_python'], result, status)
+    status = call(['./lzjwm.py', '--pure', '-d', baseout + '.lzjwm', '-o', baseout + '.decompressed_python'], result, status)
     status = call(
         ['diff', baseout + '.decompressed_python', fn], result, status)
-    status = call(['./lzjwm.py', '-c', fn, '-o', baseout + '.lzjwm_python'], result, status)
+    status = call(['./lzjwm.py', '--pure', '-c', fn, '-o', baseout + '.lzjwm_python'], result, status)
     status = call(['./lzjwm', '-d'], result, status,
                   stdin=baseout + '.lzjwm_python', stdout=baseout + '.decompressed_c')
     status = call(
@@ -78,10 +78,108 @@ for fn in sorted(glob.glob(base + '/*')):
                   stdin=baseout + '.lzjwm_python', stdout=baseout + '.decompressed_tiny')
     status = call(
         ['diff', baseout + '.decompressed_tiny', fn], result, status)
+    status = call(['./lzjwm', '-c', '-L', '3'], result, status,
+                  stdin=str(pp), stdout=baseout + '.lzjwm_best')
+    status = call(['./tiny_lzjwm'], result, status,
+                  stdin=baseout + '.lzjwm_best', stdout=baseout + '.decompressed_best')
+    status = call(
+        ['diff', baseout + '.decompressed_best', fn], result, status)
+    status = call(['./lzjwm', '-c', '-j', '4', '-b', '4096'], result, status,
+                  stdin=str(pp), stdout=baseout + '.lzjwm_parallel')
+    status = call(['./tiny_lzjwm'], result, status,
+                  stdin=baseout + '.lzjwm_parallel', stdout=baseout + '.decompressed_parallel')
+    status = call(
+        ['diff', baseout + '.decompressed_parallel', fn], result, status)
+    status = call(['./lzjwm', '-R'], result, status,
+                  stdin=baseout + '.lzjwm', stdout=baseout + '.decompressed_ring')
+    status = call(
+        ['diff', baseout + '.decompressed_ring', fn], result, status)
+    status = call(['./lzjwm', '-F'], result, status,
+                  stdin=baseout + '.lzjwm', stdout=baseout + '.decompressed_fast')
+    status = call(
+        ['diff', baseout + '.decompressed_fast', fn], result, status)
+    with open(fn, 'rb') as fh, open(baseout + '.range_expected', 'wb') as fh2:
+        fh2.write(fh.read()[1000:6000])
+    status = call(['./lzjwm', '-r', '1000,5000'], result, status,
+                  stdin=baseout + '.lzjwm', stdout=baseout + '.decompressed_range')
+    status = call(
+        ['diff', baseout + '.decompressed_range', baseout + '.range_expected'], result, status)
+    status = call(['./lzjwm', '-d', '-j', '4'], result, status,
+                  stdin=baseout + '.lzjwm', stdout=baseout + '.decompressed_slices')
+    status = call(
+        ['diff', baseout + '.decompressed_slices', fn], result, status)
+    status = call(['./lzjwm', '-c', '-C', '3', '-Z', '1'], result, status,
+                  stdin=str(pp), stdout=baseout + '.lzjwm_c3z1')
+    status = call(['./lzjwm', '-d', '-C', '3', '-Z', '1'], result, status,
+                  stdin=baseout + '.lzjwm_c3z1', stdout=baseout + '.decompressed_c3z1')
+    status = call(
+        ['diff', baseout + '.decompressed_c3z1', fn], result, status)
+    status = call(['./lzjwm', '-R', '-C', '3', '-Z', '1'], result, status,
+                  stdin=baseout + '.lzjwm_c3z1', stdout=baseout + '.decompressed_ring_c3z1')
+    status = call(
+        ['diff', baseout + '.decompressed_ring_c3z1', fn], result, status)
+    status = call(['./lzjwm', '--tune', '-j', '2'], result, status,
+                  stdin=str(pp), stdout=baseout + '.tune.h')
+    status = call(['./lzjwm', '-c', '-B', '3'], result, status,
+                  stdin=str(pp), stdout=baseout + '.lzjwm_bound')
+    status = call(['./tiny_lzjwm'], result, status,
+                  stdin=baseout + '.lzjwm_bound', stdout=baseout + '.decompressed_bound')
+    status = call(
+        ['diff', baseout + '.decompressed_bound', fn], result, status)
+    status = call(['./lzjwm', '-a', '--budget', str(3 * os.path.getsize(fn))], result, status,
+                  stdin=baseout + '.lzjwm_bound', stdout=baseout + '.analysis.json')
+    status = call(['./lzjwm', '-c', '-l', '-0', '-f', 'yaml'], result, status,
+                  stdin=str(pp), stdout=baseout + '.records.yaml')
+    status = call(['./lzjwm.py', '--pure', '-c', '-l', '-0', '-f', 'yaml', fn, '-o', baseout + '.records_python.yaml'], result, status)
+    status = call(
+        ['diff', baseout + '.records.yaml', baseout + '.records_python.yaml'], result, status)
+    status = call(['./lzjwm.py', '-c', '-l', '-S', '-f', 'yaml', fn, '-o', baseout + '.shared.yaml'], result, status)
+    status = call(['util/check_records.py', baseout + '.shared.yaml', fn], result, status)
+    status = call(['./lzjwm.py', '-c', '-l', '-O', '-f', 'yaml', fn, '-o', baseout + '.ordered.yaml'], result, status)
+    status = call(['util/check_records.py', baseout + '.ordered.yaml', fn], result, status)
+    # with the C module built this checks it against the python code
+    status = call(['./lzjwm.py', '-c', fn, '-o', baseout + '.lzjwm_module'], result, status)
+    status = call(
+        ['diff', baseout + '.lzjwm_module', baseout + '.lzjwm_python'], result, status)
+    # half the lines go in a table and the rest are appended to it
+    with open(fn, 'rb') as fh:
+        lines = fh.read().splitlines(keepends=True)
+    with open(baseout + '.head', 'wb') as fh, open(baseout + '.tail', 'wb') as fh2:
+        fh.write(b''.join(lines[:len(lines) // 2]))
+        fh2.write(b''.join(lines[len(lines) // 2:]))
+    status = call(['./lzjwm.py', '-c', '-l', '-0', '-f', 'yaml', baseout + '.head', '-o', baseout + '.head.yaml'],
+                  result, status)
+    status = call(['./lzjwm.py', '-c', '-l', '-0', '-f', 'yaml', '-A', baseout + '.head.yaml', baseout + '.tail',
+                   '-o', baseout + '.appended.yaml'], result, status)
+    status = call(['util/check_records.py', baseout + '.appended.yaml', fn, '-0'], result, status)
+    status = call(['./lzjwm', '--optimize', '--time', '2'], result, status,
+                  stdin=baseout + '.lzjwm', stdout=baseout + '.lzjwm_optimized')
+    status = call(['./lzjwm', '-d'], result, status,
+                  stdin=baseout + '.lzjwm_optimized', stdout=baseout + '.decompressed_optimized')
+    status = call(
+        ['diff', baseout + '.decompressed_optimized', fn], result, status)
+    status = call(['./lzjwm', '--train'], result, status,
+                  stdin=str(pp), stdout=baseout + '.dict')
+    status = call(['./lzjwm', '-c', '-L', '2', '-D', baseout + '.dict'], result, status,
+                  stdin=str(pp), stdout=baseout + '.lzjwm_dict')
+    status = call(['./lzjwm', '-d', '-D', baseout + '.dict'], result, status,
+                  stdin=baseout + '.lzjwm_dict', stdout=baseout + '.decompressed_dict')
+    status = call(
+        ['diff', baseout + '.decompressed_dict', fn], result, status)
 
 
 tab = tabulate(results, ['name', 'compress', 'decompress',
-                         'decom_stream', 'diff', 'diff_stream', 'decom_python', 'diff_python','comp_python','decom_c','diff_p2c','tiny', 'diff_tiny'])
+                         'decom_stream', 'diff', 'diff_stream', 'decom_python', 'diff_python','comp_python','decom_c','diff_p2c','tiny', 'diff_tiny', 'comp_best', 'tiny_best', 'diff_best',
+                         'comp_par', 'tiny_par', 'diff_par', 'decom_ring', 'diff_ring',
+                         'decom_fast', 'diff_fast', 'range', 'diff_range',
+                         'decom_par', 'diff_decom_par', 'comp_c3z1', 'decom_c3z1',
+                         'diff_c3z1', 'ring_c3z1', 'diff_ring_c3z1', 'tune',
+                         'comp_bound', 'tiny_bound', 'diff_bound', 'analyze',
+                         'comp_records', 'records_python', 'diff_records',
+                         'comp_shared', 'check_shared', 'comp_ordered', 'check_ordered', 'comp_module', 'diff_module',
+                         'comp_head', 'comp_append', 'check_append',
+                         'optimize', 'decom_optimized', 'diff_optimized',
+                         'train', 'comp_dict', 'decom_dict', 'diff_dict'])
 log.write(tab)
 log.flush()
 print(tab)